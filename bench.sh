@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# bench.sh - throughput of tst, run by make bench
+#
+#   sh bench.sh [rows]                 - results on stdout
+#   sh bench.sh -compare old.txt new.txt - how new differs from old
+#
+# Each result is a tab separated name, value and unit line so runs
+# from different versions can be compared, ns/op is better lower and
+# rows/s and MB/s better higher.  The generated files are kept in
+# bench-data (or $BENCH_DATA) and reused when the same size is asked
+# for again.
+
+if [ "$1" = "-compare" ]; then
+  awk -F '\t' '
+    /^#/ { next }
+    FNR == NR { old[$1 " " $3] = $2; next }
+    old[$1 " " $3] > 0 {
+      k = $1 " " $3
+      d = ($2 - old[k]) * 100 / old[k]
+      if($3 == "ns/op") d = -d
+      printf("%-56s %12.2f %12.2f %+7.1f%%%s\n", k, old[k], $2, d,
+             d < -5 ? " slower" : "")
+    }' "$2" "$3"
+  exit 0
+fi
+
+rows=${1:-1000000}
+data=${BENCH_DATA:-bench-data}
+mkdir -p "$data" || exit 1
+
+# gen name rows options... - make up $data/name-rows.csv once, again
+# if it's an old one that starts with tst-gen's option listing
+gen() {
+  f="$data/$1-$2.csv"
+  n=$2
+  shift 2
+  if [ ! -s "$f" ] || [ "$(head -c 1 "$f")" = "#" ]; then
+    ./tst-gen -rows $n "$@" >"$f" || exit 1
+  fi
+  echo "$f"
+}
+
+ms() {
+  echo $(($(date +%s%N) / 1000000))
+}
+
+# run name file rows options... - best of three
+run() {
+  name=$1
+  f=$2
+  n=$3
+  shift 3
+  best=
+  for i in 1 2 3; do
+    t0=$(ms)
+    ./tst -help 0 "$@" "$f" >/dev/null || exit 1
+    t=$(($(ms) - t0))
+    [ -z "$best" ] || [ $t -lt $best ] && best=$t
+  done
+  [ $best -gt 0 ] || best=1
+  bytes=$(wc -c <"$f")
+  opts=$(echo "$*" | tr ' ' '_')
+  printf "e2e/%s/%s\t%d\trows/s\n" $name "${opts:-none}" $((n * 1000 / best))
+  printf "e2e/%s/%s\t%.1f\tMB/s\n" $name "${opts:-none}" \
+    $(echo "$bytes $best" | awk '{ print $1 / $2 / 1000 }')
+}
+
+echo "# tst bench $(git describe --always --dirty 2>/dev/null) $(date -u +%FT%TZ)"
+echo "# $(uname -srm), $rows rows"
+
+./tst-bench || exit 1
+
+iso=$(gen iso $rows -cols 4)
+for o in "" "-dv 1" "-every 1m" "-every 1m -agg mean,max" "-sd 1" \
+	 "-vfmt shortest" "-t ms" "-out bin" "-threads 4"; do
+  run iso $iso $rows $o
+done
+run iso-narrow $(gen iso-narrow $rows -cols 1) $rows
+run iso-wide $(gen iso-wide $((rows / 8)) -cols 32) $((rows / 8))
+run iso-sparse $(gen iso-sparse $rows -cols 4 -sparse 0.7) $rows -dv 1
+run ms $(gen ms $rows -cols 4 -t ms) $rows
+run epoch $(gen epoch $rows -cols 4 -t epoch) $rows
+run delta $(gen delta $rows -cols 4 -t delta) $rows
+run pi $(gen pi $((rows / 10)) -cols 4 -t pi) $((rows / 10))
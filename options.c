@@ -65,7 +65,7 @@ void init_options(int argc, char* argv[]) {
 	noptions++;
       } else {
 	fprintf(stderr, "%s: fatal no argument for %s\n",
-		progname, argv[i]);
+		progname, argv[i - 1]);
 	exit(101);
       }
     } else {
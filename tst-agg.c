@@ -0,0 +1,305 @@
+/*
+ * tst-agg.c - streaming per bucket aggregates for -every, mean, min,
+ *   max, first, last, count, time weighted average and integral.
+ *
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "tst-agg.h"
+
+static char* names[AGG_N] = {
+  "mean", "min", "max", "first", "last", "count", "twa", "integral"
+};
+
+char* agg_name(int kind) {
+  return names[kind];
+}
+
+int agg_parse(char* list, int* kinds) {
+  int n = 0;
+  char* s = strdup(list);
+  char* save;
+  char* w;
+  for(w = strtok_r(s, ",", &save); w != NULL; w = strtok_r(NULL, ",", &save)) {
+    int k;
+    for(k = 0; k < AGG_N && strcmp(w, names[k]) != 0; k++) {
+    }
+    if(k == AGG_N || n == AGG_N) {
+      free(s);
+      return -1;
+    }
+    kinds[n++] = k;
+  }
+  free(s);
+  return n;
+}
+
+// one column of one bucket
+struct col {
+  double sum, min, max, first, last;
+  long count;
+  double tw, dt; // sum of v * dt and of dt for twa
+  double area; // value * ms for integral
+  bool have; // lt,lv is a sample
+  tms lt; // the last sample
+  double lv;
+};
+
+struct agg {
+  int nv;
+  tms every;
+  tms iunit;
+  int nk;
+  int kinds[AGG_N];
+  bool open; // b is a bucket
+  tms b; // its start
+  struct col* c; // c[0..nv-1]
+  double* out; // out[0..nv*nk-1]
+};
+
+struct agg* agg_new(int nv, tms every, tms iunit, int nk, int* kinds) {
+  struct agg* a = calloc(1, sizeof(struct agg));
+  if(a == NULL || (a->c = calloc(nv, sizeof(struct col))) == NULL ||
+     (a->out = calloc(nv * nk + 1, sizeof(double))) == NULL) {
+    fprintf(stderr, "tst: fatal out of memory for -agg\n");
+    exit(115);
+  }
+  a->nv = nv;
+  a->every = every;
+  a->iunit = iunit;
+  a->nk = nk;
+  memcpy(a->kinds, kinds, nk * sizeof(int));
+  return a;
+}
+
+void agg_free(struct agg* a) {
+  free(a->c);
+  free(a->out);
+  free(a);
+}
+
+// bucket - start of the bucket t is in
+static tms bucket(tms t, tms every) {
+  tms b = t / every * every;
+  return b > t ? b - every : b; // round down for t < 0
+}
+
+// reset - start the next bucket for c
+static void reset(struct col* c) {
+  c->sum = c->tw = c->dt = c->area = 0;
+  c->count = 0;
+}
+
+// segment - the part x..y of the line from c's last sample to tn,vn
+//   goes into the time weighted aggregates
+static void segment(struct col* c, tms x, tms y, tms tn, double vn) {
+  if(!c->have || y <= x) {
+    return;
+  }
+  double d = y - x;
+  c->tw += c->lv * d;
+  c->dt += d;
+  if(tn > c->lt) { // straight line from lt,lv to tn,vn
+    double s = (vn - c->lv) / (tn - c->lt);
+    double vx = c->lv + s * (x - c->lt);
+    double vy = c->lv + s * (y - c->lt);
+    c->area += (vx + vy) / 2 * d;
+  } else {
+    c->area += c->lv * d;
+  }
+}
+
+// flush - hand the current bucket to emit and start the next one
+static void flush(struct agg* a, emit_fn emit, void* arg) {
+  int i, k;
+  for(i = 0; i < a->nv; i++) {
+    struct col* c = &a->c[i];
+    for(k = 0; k < a->nk; k++) {
+      double x = NAN;
+      switch(a->kinds[k]) {
+      case AGG_MEAN:  x = c->count ? c->sum / c->count : NAN; break;
+      case AGG_MIN:   x = c->count ? c->min : NAN; break;
+      case AGG_MAX:   x = c->count ? c->max : NAN; break;
+      case AGG_FIRST: x = c->count ? c->first : NAN; break;
+      case AGG_LAST:  x = c->count ? c->last : NAN; break;
+      case AGG_COUNT: x = c->count; break;
+      case AGG_TWA:
+	x = c->dt > 0 ? c->tw / c->dt : c->have ? c->lv : NAN;
+	break;
+      case AGG_INTEGRAL: x = c->area / a->iunit; break;
+      }
+      a->out[i * a->nk + k] = x;
+    }
+    reset(c);
+  }
+  emit(arg, a->b, a->out);
+  a->b += a->every;
+}
+
+void agg_add(struct agg* a, tms t, double* v, emit_fn emit, void* arg) {
+  tms b = bucket(t, a->every);
+  int i;
+  if(!a->open) {
+    a->open = true;
+    a->b = b;
+  }
+  while(a->b < b) { // close this bucket, and any empty ones up to b
+    tms e = a->b + a->every;
+    for(i = 0; i < a->nv; i++) {
+      struct col* c = &a->c[i];
+      if(isnan(v[i])) { // hold the last value to the end
+	segment(c, c->lt > a->b ? c->lt : a->b, e, c->lt, c->lv);
+      } else {
+	segment(c, c->lt > a->b ? c->lt : a->b, e, t, v[i]);
+      }
+    }
+    flush(a, emit, arg);
+  }
+  for(i = 0; i < a->nv; i++) {
+    struct col* c = &a->c[i];
+    double x = v[i];
+    if(isnan(x)) {
+      continue;
+    }
+    segment(c, c->lt > a->b ? c->lt : a->b, t, t, x);
+    if(c->count == 0) {
+      c->first = c->min = c->max = x;
+    } else {
+      c->min = x < c->min ? x : c->min;
+      c->max = x > c->max ? x : c->max;
+    }
+    c->sum += x;
+    c->last = x;
+    c->count++;
+    c->have = true;
+    c->lt = t;
+    c->lv = x;
+  }
+}
+
+void agg_end(struct agg* a, emit_fn emit, void* arg) {
+  if(a->open) {
+    flush(a, emit, arg);
+    a->open = false;
+  }
+}
+
+// agg_save - the open bucket to fp as text so -follow can carry on
+//   with it, hex floats so nothing is lost
+void agg_save(struct agg* a, FILE* fp) {
+  fprintf(fp, "agg %d %ld\n", a->open, a->b);
+  int i;
+  for(i = 0; i < a->nv; i++) {
+    struct col* c = &a->c[i];
+    fprintf(fp, "%a %a %a %a %a %ld %a %a %a %d %ld %a\n",
+	    c->sum, c->min, c->max, c->first, c->last, c->count,
+	    c->tw, c->dt, c->area, c->have, c->lt, c->lv);
+  }
+}
+
+bool agg_load(struct agg* a, FILE* fp) {
+  int open, have;
+  if(fscanf(fp, " agg %d %ld", &open, &a->b) != 2) {
+    return false;
+  }
+  a->open = open;
+  int i;
+  for(i = 0; i < a->nv; i++) {
+    struct col* c = &a->c[i];
+    if(fscanf(fp, "%la %la %la %la %la %ld %la %la %la %d %ld %la",
+	      &c->sum, &c->min, &c->max, &c->first, &c->last, &c->count,
+	      &c->tw, &c->dt, &c->area, &have, &c->lt, &c->lv) != 12) {
+      return false;
+    }
+    c->have = have;
+  }
+  return true;
+}
+
+#ifdef TEST
+static int rows;
+static double* last;
+
+static void show(void* arg, tms b, double* out) {
+  printf("%ld", b);
+  int k;
+  for(k = 0; k < AGG_N; k++) {
+    printf(" %s=%g", agg_name(k), out[k]);
+  }
+  printf("\n");
+  rows++;
+  last = out;
+}
+
+// a ramp 0..1 over 0..1000ms in 100ms buckets sampled every 10ms
+int main() {
+  int kinds[AGG_N];
+  int nk = agg_parse("mean,min,max,first,last,count,twa,integral", kinds);
+  struct agg* a = agg_new(1, 100, 1000, nk, kinds);
+  int i, bad = 0;
+  for(i = 0; i <= 100; i++) {
+    double v = i / 100.0;
+    agg_add(a, i * 10, &v, show, NULL);
+    if(i == 50) { // bucket 400..500 has just closed
+      bad += fabs(last[AGG_INTEGRAL] - 0.045) > 1e-12;
+      bad += fabs(last[AGG_TWA] - 0.445) > 1e-12;
+      bad += last[AGG_COUNT] != 10 || last[AGG_FIRST] != 0.4;
+    }
+  }
+  double gap = 5;
+  agg_add(a, 1350, &gap, show, NULL); // 1000..1300 are empty but held
+  bad += rows != 13 || !isnan(last[AGG_MEAN]) || last[AGG_TWA] != 1;
+  agg_end(a, show, NULL);
+  bad += rows != 14 || last[AGG_COUNT] != 1;
+  agg_free(a);
+
+  // a NaN in the sample that closes a bucket still holds that
+  // column's last value to the end of the bucket
+  a = agg_new(2, 10000, 1000, nk, kinds);
+  double ab[][2] = { { 1, 1 }, { 1, 1 }, { 1, NAN }, { 1, 1 }, { 1, 1 } };
+  tms ts[] = { 0, 5000, 15000, 25000, 35000 };
+  for(i = 0; i < 5; i++) {
+    agg_add(a, ts[i], ab[i], show, NULL);
+    if(i >= 2) { // 0..10s, 10..20s, 20..30s have just closed
+      bad += last[AGG_INTEGRAL] != 10 || last[nk + AGG_INTEGRAL] != 10;
+      bad += last[AGG_TWA] != 1 || last[nk + AGG_TWA] != 1;
+    }
+  }
+  agg_free(a);
+  bad += agg_parse("mean,median", kinds) != -1;
+  printf("%d bad\n", bad);
+  return bad != 0;
+}
+#endif
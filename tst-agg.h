@@ -0,0 +1,77 @@
+/*
+ * tst-agg.h - streaming per bucket aggregates for -every
+ *
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TST_AGG_H_
+#define _TST_AGG_H_ 1
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "tst-t.h"
+
+// Samples are added in time order and each one updates the running
+// aggregates of the bucket [b, b + every) it falls in, O(1) per value
+// whatever the bucket size.  When a sample lands in a later bucket
+// the current one (and any empty ones in between) are handed to
+// emit with b and out[c * nk + k], aggregate kinds[k] of column c:
+//
+//   mean min max first last count - over the samples in the bucket,
+//     NaN values are ignored and empty buckets give NaN (count 0)
+//   twa - time weighted average holding each value until the next
+//     sample, including the value carried in from before b
+//   integral - trapezoidal integral over the bucket in value * iunit,
+//     e.g. kWh from kW with iunit 1h
+//
+// The last bucket only runs to its last sample.
+
+enum {
+  AGG_MEAN, AGG_MIN, AGG_MAX, AGG_FIRST, AGG_LAST, AGG_COUNT,
+  AGG_TWA, AGG_INTEGRAL, AGG_N
+};
+
+struct agg;
+
+// agg_parse - "mean,max,..." into kinds[0..AGG_N-1], the number of
+//   them or -1 if one isn't known
+int agg_parse(char* list, int* kinds);
+char* agg_name(int kind);
+
+struct agg* agg_new(int nv, tms every, tms iunit, int nk, int* kinds);
+void agg_free(struct agg* a);
+void agg_add(struct agg* a, tms t, double* v, emit_fn emit, void* arg);
+void agg_end(struct agg* a, emit_fn emit, void* arg);
+// the state between samples as text, agg_load is false if fp
+// doesn't hold what agg_save wrote for the same nv
+void agg_save(struct agg* a, FILE* fp);
+bool agg_load(struct agg* a, FILE* fp);
+
+#endif /* _TST_AGG_H_ */
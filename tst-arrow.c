@@ -0,0 +1,467 @@
+/*
+ * tst-arrow.c - Apache Arrow IPC stream and file output, the
+ *   flatbuffer metadata is built by hand so nothing is linked in.
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "tst-arrow.h"
+#include "tst-write.h"
+
+static void* arrow_alloc(void* p, size_t n) {
+  if((p = realloc(p, n)) == NULL) {
+    fprintf(stderr, "tst: fatal out of memory in arrow output\n");
+    exit(124);
+  }
+  return p;
+}
+
+// A flatbuffer built front to back.  Tables are written before the
+// strings, vectors and tables they point at and those offsets are
+// filled in once the target's position is known, they only ever
+// point forwards.  Everything is little endian and aligned to its
+// size from the start of the buffer.
+struct fb {
+  uint8_t* p;
+  size_t n; // bytes used
+  size_t size; // allocated
+};
+
+static void fb_le(struct fb* b, uint64_t v, int n) {
+  if(b->n + n > b->size) {
+    b->size = 2 * (b->n + n);
+    b->p = arrow_alloc(b->p, b->size);
+  }
+  int i;
+  for(i = 0; i < n; i++) {
+    b->p[b->n++] = v >> (8 * i);
+  }
+}
+
+// fb_pad - zeros until n is k more than a multiple of a
+static void fb_pad(struct fb* b, size_t a, size_t k) {
+  while(b->n % a != k) {
+    fb_le(b, 0, 1);
+  }
+}
+
+// fb_point - make the offset at at point to to
+static void fb_point(struct fb* b, size_t at, size_t to) {
+  uint32_t off = to - at;
+  int i;
+  for(i = 0; i < 4; i++) {
+    b->p[at + i] = off >> (8 * i);
+  }
+}
+
+// a table field, size 0 if it's left out, an offset to fill in
+// later is size 4, otherwise size bytes of v
+struct fbf {
+  int size;
+  uint64_t v;
+};
+
+// fb_table - the vtable then a table of fields f[0..nf-1], returns
+//   where the table starts and sets at[i] to where field i went.
+//   Fields go in largest first from 4 past a multiple of 8 so they
+//   all land aligned after the vtable offset.
+static size_t fb_table(struct fb* b, int nf, struct fbf* f, size_t* at) {
+  size_t len = 4;
+  int i, s;
+  uint16_t pos[nf];
+  for(s = 8; s >= 1; s /= 2) {
+    for(i = 0; i < nf; i++) {
+      if(f[i].size == s) {
+	pos[i] = len;
+	len += s;
+      }
+    }
+  }
+  fb_pad(b, 2, 0);
+  size_t vt = b->n;
+  fb_le(b, 4 + 2 * nf, 2);
+  fb_le(b, len, 2);
+  for(i = 0; i < nf; i++) {
+    fb_le(b, f[i].size > 0 ? pos[i] : 0, 2);
+  }
+  fb_pad(b, 8, 4);
+  size_t t = b->n;
+  fb_le(b, t - vt, 4); // the vtable is at t less this
+  for(s = 8; s >= 1; s /= 2) {
+    for(i = 0; i < nf; i++) {
+      if(f[i].size == s) {
+	at[i] = b->n;
+	fb_le(b, f[i].v, s);
+      }
+    }
+  }
+  return t;
+}
+
+// fb_vec - the length of a vector of n elements aligned to a,
+//   returns where it starts, the elements follow
+static size_t fb_vec(struct fb* b, int n, int a) {
+  fb_pad(b, a > 4 ? a : 4, a > 4 ? a - 4 : 0);
+  size_t v = b->n;
+  fb_le(b, n, 4);
+  return v;
+}
+
+static size_t fb_string(struct fb* b, char* s) {
+  size_t len = strlen(s), v = fb_vec(b, len, 1), i;
+  for(i = 0; i <= len; i++) { // with the '\0'
+    fb_le(b, s[i], 1);
+  }
+  return v;
+}
+
+// the parts of the Arrow schema (Schema.fbs, Message.fbs and
+// File.fbs in the Arrow sources) that are used here
+#define METADATA_V5 4
+#define HEADER_SCHEMA 1
+#define HEADER_RECORD_BATCH 3
+#define TYPE_FLOATING_POINT 3
+#define TYPE_TIMESTAMP 10
+#define PRECISION_DOUBLE 2
+#define UNIT_MILLISECOND 1
+#define ENDIAN_LITTLE 0
+#define ENDIAN_BIG 1
+
+struct arrow_w {
+  bool file; // the file format with its footer
+  char* tz;
+  int nv;
+  char** vlabels;
+  int n; // rows in this batch
+  tms* t;
+  double* v; // v[c * ARROW_ROWS + i]
+  struct fb b; // metadata for the next message
+  uint64_t off; // bytes written so far
+  int nblocks; // batches in blocks for the footer
+  struct fb blocks;
+};
+
+// put_field - a Field table and what it points to, a timestamp
+//   column if tz isn't NULL otherwise float64
+static size_t put_field(struct fb* b, char* name, char* tz) {
+  // name nullable type_type type dictionary children
+  struct fbf f[6] = { { 4 }, { 0 },
+		      { 1, tz != NULL ? TYPE_TIMESTAMP : TYPE_FLOATING_POINT },
+		      { 4 }, { 0 }, { 4 } };
+  size_t at[6], gat[2];
+  size_t t = fb_table(b, 6, f, at);
+  fb_point(b, at[0], fb_string(b, name));
+  if(tz != NULL) { // unit timezone
+    struct fbf g[2] = { { 2, UNIT_MILLISECOND }, { 4 } };
+    fb_point(b, at[3], fb_table(b, 2, g, gat));
+    fb_point(b, gat[1], fb_string(b, tz));
+  } else { // precision
+    struct fbf g[1] = { { 2, PRECISION_DOUBLE } };
+    fb_point(b, at[3], fb_table(b, 1, g, gat));
+  }
+  fb_point(b, at[5], fb_vec(b, 0, 4)); // readers want the empty list
+  return t;
+}
+
+// put_schema - the Schema table, t then the values
+static size_t put_schema(struct fb* b, struct arrow_w* w) {
+  // endianness fields
+  struct fbf f[2] = { { 2, __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ ?
+			ENDIAN_BIG : ENDIAN_LITTLE }, { 4 } };
+  size_t at[2];
+  size_t t = fb_table(b, 2, f, at);
+  size_t v = fb_vec(b, 1 + w->nv, 4);
+  fb_point(b, at[1], v);
+  int c;
+  for(c = 0; c <= w->nv; c++) {
+    fb_le(b, 0, 4);
+  }
+  for(c = 0; c <= w->nv; c++) {
+    size_t e = v + 4 + 4 * c;
+    fb_point(b, e, c == 0 ? put_field(b, "t", w->tz) :
+	     put_field(b, w->vlabels[c - 1], NULL));
+  }
+  return t;
+}
+
+// put_message - the root Message table in a fresh buffer, returns
+//   where its header offset is
+static size_t put_message(struct fb* b, int type, uint64_t body) {
+  b->n = 0;
+  fb_le(b, 0, 4); // the root offset
+  // version header_type header bodyLength
+  struct fbf f[4] = { { 2, METADATA_V5 }, { 1, type }, { 4 }, { 8, body } };
+  size_t at[4];
+  fb_point(b, 0, fb_table(b, 4, f, at));
+  return at[2];
+}
+
+// write_message - the message in w->b as continuation marker, length
+//   and the padded metadata, returns the bytes written
+static size_t write_message(struct arrow_w* w) {
+  fb_pad(&w->b, 8, 0);
+  uint8_t pre[8];
+  memset(pre, 0xff, 4);
+  int i;
+  for(i = 0; i < 4; i++) {
+    pre[4 + i] = w->b.n >> (8 * i);
+  }
+  wr_mem((char*) pre, 8);
+  wr_mem((char*) w->b.p, w->b.n);
+  w->off += 8 + w->b.n;
+  return 8 + w->b.n;
+}
+
+struct arrow_w* arrow_w_open(bool file, char* tz, int nv, char** vlabels) {
+  struct arrow_w* w = arrow_alloc(NULL, sizeof(struct arrow_w));
+  memset(w, 0, sizeof(*w));
+  w->file = file;
+  w->tz = strdup(tz);
+  w->nv = nv;
+  w->vlabels = arrow_alloc(NULL, sizeof(char*) * (nv > 0 ? nv : 1));
+  int c;
+  for(c = 0; c < nv; c++) {
+    w->vlabels[c] = strdup(vlabels[c]);
+  }
+  w->t = arrow_alloc(NULL, sizeof(tms) * ARROW_ROWS);
+  w->v = arrow_alloc(NULL, sizeof(double) * ARROW_ROWS * (nv > 0 ? nv : 1));
+  if(file) {
+    wr_mem("ARROW1\0\0", 8);
+    w->off = 8;
+  }
+  size_t h = put_message(&w->b, HEADER_SCHEMA, 0);
+  fb_point(&w->b, h, put_schema(&w->b, w));
+  write_message(w);
+  return w;
+}
+
+// arrow_w_batch - the rows so far as a record batch, each column is
+//   one buffer written straight from t or v
+static void arrow_w_batch(struct arrow_w* w) {
+  if(w->n == 0) {
+    return;
+  }
+  struct fb* b = &w->b;
+  int nc = 1 + w->nv, c;
+  uint64_t col = (uint64_t) w->n * 8;
+  uint64_t off = w->off;
+  size_t h = put_message(b, HEADER_RECORD_BATCH, nc * col);
+  struct fbf f[3] = { { 8, w->n }, { 4 }, { 4 } }; // length nodes buffers
+  size_t at[3];
+  fb_point(b, h, fb_table(b, 3, f, at));
+  fb_point(b, at[1], fb_vec(b, nc, 8));
+  for(c = 0; c < nc; c++) { // FieldNode length null_count
+    fb_le(b, w->n, 8);
+    fb_le(b, 0, 8);
+  }
+  fb_point(b, at[2], fb_vec(b, 2 * nc, 8));
+  for(c = 0; c < nc; c++) { // Buffer offset length, no validity bitmap
+    fb_le(b, c * col, 8);
+    fb_le(b, 0, 8);
+    fb_le(b, c * col, 8);
+    fb_le(b, col, 8);
+  }
+  size_t meta = write_message(w);
+  wr_mem((char*) w->t, col);
+  for(c = 0; c < w->nv; c++) {
+    wr_mem((char*) &w->v[c * ARROW_ROWS], col);
+  }
+  w->off += nc * col;
+  // a Block in the footer, offset metaDataLength:int (and 4 bytes
+  // of padding) bodyLength
+  fb_le(&w->blocks, off, 8);
+  fb_le(&w->blocks, meta, 8);
+  fb_le(&w->blocks, nc * col, 8);
+  w->nblocks++;
+  w->n = 0;
+}
+
+void arrow_w_rows(struct arrow_w* w, int n, tms* t, double* v) {
+  int i = 0, c;
+  while(i < n) {
+    int k = n - i < ARROW_ROWS - w->n ? n - i : ARROW_ROWS - w->n;
+    memcpy(&w->t[w->n], &t[i], k * sizeof(tms));
+    for(c = 0; c < w->nv; c++) {
+      memcpy(&w->v[c * ARROW_ROWS + w->n], &v[c * n + i],
+	     k * sizeof(double));
+    }
+    i += k;
+    if((w->n += k) == ARROW_ROWS) {
+      arrow_w_batch(w);
+    }
+  }
+}
+
+// arrow_w_close - the last batch, the end of stream marker and for
+//   the file format the footer, its length and the magic again
+void arrow_w_close(struct arrow_w* w) {
+  arrow_w_batch(w);
+  wr_mem("\xff\xff\xff\xff\0\0\0\0", 8);
+  if(w->file) {
+    struct fb* b = &w->b;
+    b->n = 0;
+    fb_le(b, 0, 4);
+    // version schema dictionaries recordBatches
+    struct fbf f[4] = { { 2, METADATA_V5 }, { 4 }, { 4 }, { 4 } };
+    size_t at[4];
+    fb_point(b, 0, fb_table(b, 4, f, at));
+    fb_point(b, at[1], put_schema(b, w));
+    fb_point(b, at[2], fb_vec(b, 0, 8));
+    fb_point(b, at[3], fb_vec(b, w->nblocks, 8));
+    size_t i;
+    for(i = 0; i < w->blocks.n; i++) {
+      fb_le(b, w->blocks.p[i], 1);
+    }
+    uint8_t len[4];
+    for(i = 0; i < 4; i++) {
+      len[i] = b->n >> (8 * i);
+    }
+    wr_mem((char*) b->p, b->n);
+    wr_mem((char*) len, 4);
+    wr_mem("ARROW1", 6);
+  }
+  int c;
+  for(c = 0; c < w->nv; c++) {
+    free(w->vlabels[c]);
+  }
+  free(w->vlabels);
+  free(w->tz);
+  free(w->t);
+  free(w->v);
+  free(w->b.p);
+  free(w->blocks.p);
+  free(w);
+}
+
+#ifdef TEST
+#include <unistd.h>
+#include <math.h>
+
+// just enough flatbuffer reading to follow the footer to the data
+static uint64_t le(uint8_t* p, int n) {
+  uint64_t v = 0;
+  int i;
+  for(i = n - 1; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+// fb_get - where field id of the table at t is, 0 if it isn't there
+static size_t fb_get(uint8_t* p, size_t t, int id) {
+  size_t vt = t - (int32_t) le(p + t, 4);
+  if(4 + 2 * id >= le(p + vt, 2)) {
+    return 0;
+  }
+  size_t off = le(p + vt + 4 + 2 * id, 2);
+  return off == 0 ? 0 : t + off;
+}
+
+static size_t fb_ref(uint8_t* p, size_t at) {
+  return at + le(p + at, 4);
+}
+
+// arrow - write n rows of t,a,b in the file or stream format and
+//   return how many bytes that came to in *p
+static size_t arrow(bool file, int n, uint8_t** p) {
+  char* labels[] = { "a", "b" };
+  char tmpl[] = "/tmp/tst-arrowXXXXXX";
+  int fd = mkstemp(tmpl);
+  wr_init(fd, "size");
+  struct arrow_w* w = arrow_w_open(file, "Australia/Sydney", 2, labels);
+  int i = 0, k, j;
+  while(i < n) { // in blocks of all sorts of sizes
+    k = i % 5000 + 1 < n - i ? i % 5000 + 1 : n - i;
+    tms t[k];
+    double v[2 * k];
+    for(j = 0; j < k; j++) {
+      t[j] = 1400000000000L + (i + j) * 1000L;
+      v[j] = (i + j) * 0.5;
+      v[k + j] = (i + j) % 9 == 0 ? NAN : sin(i + j);
+    }
+    arrow_w_rows(w, k, t, v);
+    i += k;
+  }
+  arrow_w_close(w);
+  wr_flush();
+  size_t size = lseek(fd, 0, SEEK_END);
+  *p = malloc(size);
+  if(pread(fd, *p, size, 0) != size) {
+    size = 0;
+  }
+  close(fd);
+  unlink(tmpl);
+  return size;
+}
+
+int main() {
+  int n = 2 * ARROW_ROWS + 17;
+  uint8_t* p;
+  size_t size = arrow(true, n, &p);
+  int bad = memcmp(p, "ARROW1\0\0", 8) != 0 ||
+    memcmp(p + size - 6, "ARROW1", 6) != 0;
+  size_t footer = size - 10 - le(p + size - 10, 4);
+  size_t t = fb_ref(p + footer, 0);
+  size_t v = fb_ref(p + footer, fb_get(p + footer, t, 3)); // recordBatches
+  int nb = le(p + footer + v, 4), b, m = 0, i;
+  for(b = 0; b < nb; b++) {
+    uint8_t* blk = p + footer + v + 4 + 24 * b;
+    size_t off = le(blk, 8), meta = le(blk + 8, 4);
+    uint8_t* msg = p + off + 8; // past the continuation and length
+    size_t mt = fb_ref(msg, 0);
+    size_t rb = fb_ref(msg, fb_get(msg, mt, 2));
+    int k = le(msg + fb_get(msg, rb, 0), 8);
+    bad += le(p + off, 4) != 0xffffffff ||
+      msg[fb_get(msg, mt, 1)] != HEADER_RECORD_BATCH ||
+      le(msg + fb_get(msg, mt, 3), 8) != le(blk + 16, 8);
+    tms* bt = (tms*) (p + off + meta);
+    double* bv = (double*) (bt + k);
+    for(i = 0; i < k; i++, m++) {
+      double x = m % 9 == 0 ? NAN : sin(m);
+      if(bt[i] != 1400000000000L + m * 1000L || bv[i] != m * 0.5 ||
+	 (bv[k + i] != x && !(isnan(x) && isnan(bv[k + i])))) {
+	bad++;
+      }
+    }
+  }
+  // the stream format is the same without the magic and footer
+  uint8_t* s;
+  size_t ssize = arrow(false, n, &s);
+  bad += ssize != footer - 8 || memcmp(s, p + 8, ssize) != 0;
+  printf("%d rows in %d batches (%zu bytes), %d bad\n", m, nb, size, bad);
+  free(p);
+  free(s);
+  return bad != 0 || m != n;
+}
+#endif
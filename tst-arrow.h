@@ -0,0 +1,60 @@
+/*
+ * tst-arrow.h - Apache Arrow IPC output
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _TST_ARROW_H_
+#define _TST_ARROW_H_ 1
+
+#include <stdbool.h>
+#include "tst-t.h"
+
+// Rows are written as Arrow IPC record batches of up to ARROW_ROWS
+// rows: a timestamp[ms, tz] column t and a float64 column for each
+// value, named from the header.  The stream format is the schema
+// message, the batches and an end of stream marker, the file format
+// wraps the same stream in "ARROW1" magic with a footer that says
+// where each batch is, so readers can memory map the file and use
+// the columns in place.  The flatbuffer metadata is built here so
+// there's nothing to link, column data is in host byte order which
+// the schema records.  Missing values are NaN, never null.
+
+#define ARROW_ROWS 65536
+
+// writing, the output goes through wr_mem
+struct arrow_w;
+// file picks the file format (-out arrow) over the stream format
+// (-out arrows), tz is the zone name for the t column.
+struct arrow_w* arrow_w_open(bool file, char* tz, int nv, char** vlabels);
+// n rows t[0..n-1] with value c of row i in v[c * n + i]
+void arrow_w_rows(struct arrow_w* w, int n, tms* t, double* v);
+void arrow_w_close(struct arrow_w* w); // the last batch and footer
+
+#endif /* _TST_ARROW_H_ */
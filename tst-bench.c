@@ -0,0 +1,132 @@
+/*
+ * tst-bench.c - microbenchmarks for the inner loops of tst, one
+ *   "micro/name ns/op" line each for bench.sh.
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tst-split.h"
+#include "tst-t.h"
+#include "tst-tz.h"
+#include "tst-num.h"
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static volatile long sink; // so nothing gets optimised away
+
+// time f(arg) repeatedly for about 0.2s after a warm up and print
+// the ns per call
+static void bench(char* name, long (*f)(void*), void* arg) {
+  long n, i;
+  double t0, t;
+  for(n = 1000; ; n *= 2) {
+    t0 = now();
+    for(i = 0; i < n; i++) {
+      sink += f(arg);
+    }
+    if((t = now() - t0) > 0.2) {
+      break;
+    }
+  }
+  printf("micro/%s\t%.2f\tns/op\n", name, t * 1e9 / n);
+}
+
+static char* row = "2015-03-01T12:34:56.789Z,123.456,-0.5,1e3,42,7.25,0,99.9,3";
+static char buf[256];
+
+static long b_split_csv(void* arg) { // copying it back costs a bit
+  strcpy(buf, row);
+  return split_csv(buf);
+}
+
+static long b_parse_t(void* arg) {
+  return parse_t(arg);
+}
+
+static long b_parse_t_len(void* arg) {
+  return parse_t_len(arg, strlen(arg));
+}
+
+static long b_parse_tf(void* arg) {
+  static char* pi[] = { "%d/%m/%Y %H:%M:%S %p", NULL };
+  return parse_tf(arg, pi);
+}
+
+static long b_strtod(void* arg) {
+  return strtod(arg, NULL);
+}
+
+static long b_parse_v(void* arg) {
+  double v;
+  parse_v(arg, &v);
+  return v;
+}
+
+static long b_fmt_t(void* arg) {
+  static tms t = 1425213296789;
+  t += 1000; // a new second every time
+  return fmt_t_buf(t, buf);
+}
+
+static long b_fmt_g(void* arg) {
+  static long n;
+  return fmt_g((n++ % 1000000) / 1000.0, buf); // like 123.456
+}
+
+static long b_fmt_shortest(void* arg) {
+  static long n;
+  return fmt_shortest((n++ % 1000000) / 1000.0, buf); // like 123.456
+}
+
+int main() {
+  bench("split_csv", b_split_csv, NULL);
+  bench("parse_t_iso", b_parse_t, "2015-03-01T12:34:56.789Z");
+  bench("parse_t_ms", b_parse_t, "1425213296789");
+  bench("parse_t_len_ms", b_parse_t_len, "1425213296789");
+  bench("parse_t_pi", b_parse_t, "01/03/2015 12:34:56 PM");
+  bench("parse_tf_pi", b_parse_tf, "01/03/2015 12:34:56 PM");
+  if(tz_load("Australia/Sydney")) {
+    bench("parse_t_pi_tz", b_parse_t, "01/03/2015 12:34:56 PM");
+    tz_load("UTC");
+  }
+  bench("strtod", b_strtod, "123.456");
+  bench("parse_v", b_parse_v, "123.456");
+  bench("fmt_t", b_fmt_t, NULL);
+  bench("fmt_g", b_fmt_g, NULL);
+  bench("fmt_shortest", b_fmt_shortest, NULL);
+  return 0;
+}
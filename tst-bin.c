@@ -0,0 +1,789 @@
+/*
+ * tst-bin.c - compressed binary time series, delta-of-delta
+ *   times and XOR compressed values in blocks of rows.
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tst-bin.h"
+#include "tst-write.h"
+
+static void bin_nomem() {
+  fprintf(stderr, "tst: fatal out of memory in binary i/o\n");
+  exit(110);
+}
+
+static void* bin_alloc(size_t n) {
+  void* p = calloc(1, n);
+  if(p == NULL) {
+    bin_nomem();
+  }
+  return p;
+}
+
+static void bin_corrupt(char* why) {
+  fprintf(stderr, "tst: fatal corrupt binary input: %s\n", why);
+  exit(111);
+}
+
+// little endian helpers
+static void put_le(uint8_t* p, uint64_t v, int n) {
+  int i;
+  for(i = 0; i < n; i++) {
+    p[i] = v >> (8 * i);
+  }
+}
+
+static uint64_t get_le(const uint8_t* p, int n) {
+  uint64_t v = 0;
+  int i;
+  for(i = n - 1; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+// a growable bit stream written msb first
+struct bits {
+  uint8_t* p;
+  size_t n; // bytes used
+  size_t size; // allocated
+  uint64_t acc; // bits not yet in p
+  int nacc; // number of them, always < 8 between calls
+};
+
+static void put_byte(struct bits* b, uint8_t c) {
+  if(b->n == b->size) {
+    b->size = b->size == 0 ? 4096 : b->size * 2;
+    if((b->p = realloc(b->p, b->size)) == NULL) {
+      bin_nomem();
+    }
+  }
+  b->p[b->n++] = c;
+}
+
+static void put_bits(struct bits* b, uint64_t v, int n) {
+  if(n > 32) {
+    put_bits(b, v >> 32, n - 32);
+    n = 32;
+  }
+  v &= n == 64 ? ~0ULL : (1ULL << n) - 1;
+  b->acc = (b->acc << n) | v;
+  b->nacc += n;
+  while(b->nacc >= 8) {
+    b->nacc -= 8;
+    put_byte(b, b->acc >> b->nacc);
+  }
+  b->acc &= (1ULL << b->nacc) - 1;
+}
+
+static void end_bits(struct bits* b) {
+  if(b->nacc > 0) {
+    put_byte(b, b->acc << (8 - b->nacc));
+  }
+  b->acc = b->nacc = 0;
+}
+
+// reading side of struct bits
+struct ubits {
+  const uint8_t* p;
+  size_t n; // bytes
+  size_t pos; // next bit
+};
+
+static uint64_t get_bits(struct ubits* b, int n) {
+  if(b->pos + n > b->n * 8) {
+    bin_corrupt("block too short");
+  }
+  uint64_t v = 0;
+  while(n > 0) {
+    int off = b->pos & 7;
+    int take = 8 - off < n ? 8 - off : n;
+    uint8_t x = b->p[b->pos >> 3];
+    v = (v << take) | ((x >> (8 - off - take)) & ((1u << take) - 1));
+    b->pos += take;
+    n -= take;
+  }
+  return v;
+}
+
+static int64_t get_signed(struct ubits* b, int n) {
+  uint64_t v = get_bits(b, n);
+  if(v & (1ULL << (n - 1))) { // sign extend
+    v |= ~0ULL << n;
+  }
+  return (int64_t) v;
+}
+
+// the delta-of-delta codes for times
+static void put_times(struct bits* b, tms* t, int n) {
+  put_bits(b, t[0], 64);
+  tms pd = 0; // previous delta
+  int i;
+  for(i = 1; i < n; i++) {
+    tms d = t[i] - t[i-1];
+    int64_t dod = d - pd;
+    pd = d;
+    if(dod == 0) {
+      put_bits(b, 0, 1);
+    } else if(-64 <= dod && dod < 64) {
+      put_bits(b, 2, 2);
+      put_bits(b, dod, 7);
+    } else if(-256 <= dod && dod < 256) {
+      put_bits(b, 6, 3);
+      put_bits(b, dod, 9);
+    } else if(-2048 <= dod && dod < 2048) {
+      put_bits(b, 14, 4);
+      put_bits(b, dod, 12);
+    } else {
+      put_bits(b, 15, 4);
+      put_bits(b, dod, 64);
+    }
+  }
+}
+
+static void get_times(struct ubits* b, tms* t, int n) {
+  t[0] = (tms) get_bits(b, 64);
+  tms pd = 0;
+  int i;
+  for(i = 1; i < n; i++) {
+    int64_t dod;
+    if(get_bits(b, 1) == 0) {
+      dod = 0;
+    } else if(get_bits(b, 1) == 0) {
+      dod = get_signed(b, 7);
+    } else if(get_bits(b, 1) == 0) {
+      dod = get_signed(b, 9);
+    } else if(get_bits(b, 1) == 0) {
+      dod = get_signed(b, 12);
+    } else {
+      dod = (int64_t) get_bits(b, 64);
+    }
+    pd += dod;
+    t[i] = t[i-1] + pd;
+  }
+}
+
+static uint64_t dbits(double d) {
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  return u;
+}
+
+static double bitsd(uint64_t u) {
+  double d;
+  memcpy(&d, &u, sizeof(d));
+  return d;
+}
+
+// the XOR codes for values
+static void put_values(struct bits* b, double* v, int n) {
+  uint64_t prev = dbits(v[0]);
+  put_bits(b, prev, 64);
+  int plz = -1, ptz = 0; // the current window, none yet
+  int i;
+  for(i = 1; i < n; i++) {
+    uint64_t cur = dbits(v[i]);
+    uint64_t x = cur ^ prev;
+    prev = cur;
+    if(x == 0) {
+      put_bits(b, 0, 1);
+      continue;
+    }
+    int lz = __builtin_clzll(x);
+    int tz = __builtin_ctzll(x);
+    if(lz > 31) {
+      lz = 31;
+    }
+    if(plz >= 0 && lz >= plz && tz >= ptz) { // fits the window
+      put_bits(b, 2, 2);
+      put_bits(b, x >> ptz, 64 - plz - ptz);
+    } else {
+      int len = 64 - lz - tz;
+      put_bits(b, 3, 2);
+      put_bits(b, lz, 5);
+      put_bits(b, len - 1, 6);
+      put_bits(b, x >> tz, len);
+      plz = lz;
+      ptz = tz;
+    }
+  }
+}
+
+static void get_values(struct ubits* b, double* v, int n) {
+  uint64_t prev = get_bits(b, 64);
+  v[0] = bitsd(prev);
+  int plz = -1, ptz = 0;
+  int i;
+  for(i = 1; i < n; i++) {
+    if(get_bits(b, 1) != 0) {
+      uint64_t x;
+      if(get_bits(b, 1) == 0) {
+	if(plz < 0) {
+	  bin_corrupt("value window used before set");
+	}
+	x = get_bits(b, 64 - plz - ptz) << ptz;
+      } else {
+	plz = get_bits(b, 5);
+	int len = get_bits(b, 6) + 1;
+	ptz = 64 - plz - len;
+	if(ptz < 0) {
+	  bin_corrupt("bad value window");
+	}
+	x = get_bits(b, len) << ptz;
+      }
+      prev ^= x;
+    }
+    v[i] = bitsd(prev);
+  }
+}
+
+// writing
+
+struct bin_w {
+  int nv;
+  int n; // rows in this block
+  tms t[BIN_ROWS];
+  double* v; // v[c * BIN_ROWS + i]
+  struct bits b;
+  uint64_t off; // bytes written since the header started
+  uint32_t nix; // blocks in ix
+  struct bits ix; // the index entries so far
+};
+
+// put_ix - put n little endian bytes of v on the index
+static void put_ix(struct bin_w* w, uint64_t v, int n) {
+  uint8_t buf[8];
+  put_le(buf, v, n);
+  int i;
+  for(i = 0; i < n; i++) {
+    put_byte(&w->ix, buf[i]);
+  }
+}
+
+// ix_block - add the index entry for the block about to be written
+static void ix_block(struct bin_w* w) {
+  tms tmin = w->t[0], tmax = w->t[0];
+  int i, c;
+  for(i = 1; i < w->n; i++) {
+    if(w->t[i] < tmin) {
+      tmin = w->t[i];
+    }
+    if(w->t[i] > tmax) {
+      tmax = w->t[i];
+    }
+  }
+  put_ix(w, w->off, 8);
+  put_ix(w, w->n, 4);
+  put_ix(w, tmin, 8);
+  put_ix(w, tmax, 8);
+  for(c = 0; c < w->nv; c++) {
+    double* v = &w->v[c * BIN_ROWS];
+    double vmin = INFINITY, vmax = -INFINITY;
+    uint32_t count = 0;
+    for(i = 0; i < w->n; i++) {
+      if(v[i] == v[i]) { // not NaN
+	vmin = v[i] < vmin ? v[i] : vmin;
+	vmax = v[i] > vmax ? v[i] : vmax;
+	count++;
+      }
+    }
+    put_ix(w, dbits(vmin), 8);
+    put_ix(w, dbits(vmax), 8);
+    put_ix(w, count, 4);
+  }
+  w->nix++;
+}
+
+static size_t put_hdr(struct bin_hdr* h) {
+  uint8_t buf[20];
+  memcpy(buf, BIN_MAGIC, 4);
+  buf[4] = BIN_VERSION;
+  buf[5] = h->delta;
+  put_le(buf + 6, 0, 2);
+  put_le(buf + 8, h->tsize, 8);
+  put_le(buf + 16, h->nv, 4);
+  wr_mem((char*) buf, 20);
+  size_t size = 20;
+  int i;
+  for(i = 0; i < h->nv; i++) {
+    size_t len = strlen(h->vlabels[i]);
+    if(len > 0xffff) {
+      len = 0xffff;
+    }
+    put_le(buf, len, 2);
+    wr_mem((char*) buf, 2);
+    wr_mem(h->vlabels[i], len);
+    size += 2 + len;
+  }
+  return size;
+}
+
+struct bin_w* bin_w_open(struct bin_hdr* h) {
+  struct bin_w* w = bin_alloc(sizeof(struct bin_w));
+  w->nv = h->nv;
+  w->v = bin_alloc(sizeof(double) * BIN_ROWS * (h->nv > 0 ? h->nv : 1));
+  w->off = put_hdr(h);
+  return w;
+}
+
+// add one stream to the block buffer as length + bytes
+static void add_stream(struct bits* out, struct bits* s) {
+  end_bits(s);
+  uint8_t len[4];
+  put_le(len, s->n, 4);
+  int i;
+  for(i = 0; i < 4; i++) {
+    put_byte(out, len[i]);
+  }
+  for(i = 0; i < (int) s->n; i++) {
+    put_byte(out, s->p[i]);
+  }
+  s->n = 0;
+}
+
+static void bin_w_block(struct bin_w* w) {
+  if(w->n == 0) {
+    return;
+  }
+  static struct bits s;
+  w->b.n = 0;
+  put_times(&s, w->t, w->n);
+  add_stream(&w->b, &s);
+  int c;
+  for(c = 0; c < w->nv; c++) {
+    put_values(&s, &w->v[c * BIN_ROWS], w->n);
+    add_stream(&w->b, &s);
+  }
+  ix_block(w);
+  uint8_t hdr[8];
+  put_le(hdr, w->n, 4);
+  put_le(hdr + 4, w->b.n, 4);
+  wr_mem((char*) hdr, 8);
+  wr_mem((char*) w->b.p, w->b.n);
+  w->off += 8 + w->b.n;
+  w->n = 0;
+}
+
+void bin_w_row(struct bin_w* w, tms t, double* v) {
+  w->t[w->n] = t;
+  int c;
+  for(c = 0; c < w->nv; c++) {
+    w->v[c * BIN_ROWS + w->n] = v[c];
+  }
+  if(++w->n == BIN_ROWS) {
+    bin_w_block(w);
+  }
+}
+
+// bin_w_close - write the last block then the index
+void bin_w_close(struct bin_w* w) {
+  bin_w_block(w);
+  uint8_t buf[12];
+  memcpy(buf, BIN_INDEX, 4);
+  put_le(buf + 4, w->nix, 4);
+  put_le(buf + 8, w->nv, 4);
+  wr_mem((char*) buf, 12);
+  wr_mem((char*) w->ix.p, w->ix.n);
+  put_le(buf, w->off, 8);
+  memcpy(buf + 8, BIN_INDEX, 4);
+  wr_mem((char*) buf, 12);
+  free(w->ix.p);
+  free(w->b.p);
+  free(w->v);
+  free(w);
+}
+
+// reading
+
+struct bin_r {
+  struct rd* in;
+  struct bin_hdr h;
+  uint8_t* buf; // the current block
+  size_t size;
+  tms t[BIN_ROWS];
+  double* v;
+
+  // set by bin_r_select when there is an index
+  size_t base; // file offset of the header
+  uint8_t* ix; // the first index entry, in the map
+  int nix; // number of entries
+  int next; // next entry to read
+  int last; // and the last one
+  bool sorted; // blocks are in time order
+  bool hold; // keep blocks for sample and hold
+  tms st, et; // time range wanted
+  double vmin, vmax; // value range wanted
+};
+
+// the size of an index entry for nv values
+#define IX_SIZE(nv) (28 + 20 * (size_t) (nv))
+
+// bin_is - does in start with BIN_MAGIC after any # lines, e.g. the
+//   options tst always prints.  Only mapped files can be checked.
+bool bin_is(struct rd* in) {
+  size_t off = 0;
+  char* p;
+  while((p = rd_peek(in, off + 1)) != NULL && p[off] == '#') {
+    while((p = rd_peek(in, off + 1)) != NULL && p[off] != '\n') {
+      off++;
+    }
+    off++;
+  }
+  return (p = rd_peek(in, off + 4)) != NULL &&
+    memcmp(p + off, BIN_MAGIC, 4) == 0;
+}
+
+static void get(struct bin_r* r, void* buf, size_t n) {
+  if(rd_read(r->in, buf, n) != n) {
+    bin_corrupt("truncated");
+  }
+}
+
+// read a header after its magic into h
+static void get_hdr(struct bin_r* r, struct bin_hdr* h) {
+  uint8_t buf[16];
+  get(r, buf, 16);
+  if(buf[0] != BIN_VERSION) {
+    bin_corrupt("unknown version");
+  }
+  h->delta = buf[1];
+  h->tsize = (tms) get_le(buf + 4, 8);
+  h->nv = get_le(buf + 12, 4);
+  if(h->nv < 1 || h->nv > 1000000) {
+    bin_corrupt("bad number of values");
+  }
+  h->vlabels = bin_alloc(h->nv * sizeof(char*));
+  int i;
+  for(i = 0; i < h->nv; i++) {
+    get(r, buf, 2);
+    size_t len = get_le(buf, 2);
+    h->vlabels[i] = bin_alloc(len + 1);
+    get(r, h->vlabels[i], len);
+  }
+}
+
+static void free_hdr(struct bin_hdr* h) {
+  int i;
+  for(i = 0; i < h->nv; i++) {
+    free(h->vlabels[i]);
+  }
+  free(h->vlabels);
+}
+
+struct bin_r* bin_r_open(struct rd* in) {
+  struct bin_r* r = bin_alloc(sizeof(struct bin_r));
+  r->in = in;
+  size_t len;
+  while(rd_peekc(in) == '#') { // skip the options and comments
+    rd_line(in, &len);
+  }
+  r->base = rd_tell(in);
+  char magic[4];
+  get(r, magic, 4);
+  if(memcmp(magic, BIN_MAGIC, 4) != 0) {
+    bin_corrupt("not a tst binary file");
+  }
+  get_hdr(r, &r->h);
+  r->v = bin_alloc(sizeof(double) * BIN_ROWS * r->h.nv);
+  return r;
+}
+
+struct bin_hdr* bin_r_hdr(struct bin_r* r) {
+  return &r->h;
+}
+
+// skip n bytes of input
+static void skip(struct bin_r* r, size_t n) {
+  uint8_t buf[4096];
+  while(n > 0) {
+    size_t k = n < sizeof(buf) ? n : sizeof(buf);
+    get(r, buf, k);
+    n -= k;
+  }
+}
+
+// ix_get - field at off in index entry i
+static uint64_t ix_get(struct bin_r* r, int i, size_t off, int n) {
+  return get_le(r->ix + i * IX_SIZE(r->h.nv) + off, n);
+}
+
+// load_ix - find the index at the end of a mapped file, false if
+//   there isn't one that belongs to the stream starting at base
+static bool load_ix(struct bin_r* r) {
+  size_t size = rd_size(r->in);
+  uint8_t* p;
+  if(size < r->base + 24 ||
+     (p = (uint8_t*) rd_at(r->in, size - 12, 12)) == NULL ||
+     memcmp(p + 8, BIN_INDEX, 4) != 0) {
+    return false;
+  }
+  size_t at = r->base + get_le(p, 8); // where the index starts
+  if((p = (uint8_t*) rd_at(r->in, at, 12)) == NULL ||
+     memcmp(p, BIN_INDEX, 4) != 0 ||
+     get_le(p + 8, 4) != (uint64_t) r->h.nv) {
+    return false;
+  }
+  r->nix = get_le(p + 4, 4);
+  if(at + 12 + r->nix * IX_SIZE(r->h.nv) + 12 != size) {
+    return false;
+  }
+  r->ix = p + 12;
+  return true;
+}
+
+// ix_tmin/tmax - the time range of block i
+static tms ix_tmin(struct bin_r* r, int i) {
+  return (tms) ix_get(r, i, 12, 8);
+}
+
+static tms ix_tmax(struct bin_r* r, int i) {
+  return (tms) ix_get(r, i, 20, 8);
+}
+
+// bin_r_select - only read blocks that can have rows in st..et
+//   with a value in vmin..vmax (-inf..inf reads them all).  With hold (for
+//   sample and hold) the block before st is read as well and values
+//   don't skip blocks.  False if there is no index to do it with.
+bool bin_r_select(struct bin_r* r, tms st, tms et,
+		  double vmin, double vmax, bool hold) {
+  if(!load_ix(r)) {
+    return false;
+  }
+  r->st = st;
+  r->et = et;
+  r->vmin = vmin;
+  r->vmax = vmax;
+  r->hold = hold;
+  r->sorted = true;
+  int i;
+  for(i = 0; i < r->nix; i++) {
+    if(ix_tmin(r, i) > ix_tmax(r, i) ||
+       (i > 0 && ix_tmax(r, i - 1) > ix_tmin(r, i))) {
+      r->sorted = false;
+      break;
+    }
+  }
+  r->next = 0;
+  r->last = r->nix - 1;
+  if(r->sorted) { // binary search for the first and last blocks
+    int lo = 0, hi = r->nix;
+    while(lo < hi) { // first block with tmax >= st
+      int mid = (lo + hi) / 2;
+      if(ix_tmax(r, mid) < st) {
+	lo = mid + 1;
+      } else {
+	hi = mid;
+      }
+    }
+    r->next = hold && lo > 0 ? lo - 1 : lo;
+    hi = r->nix;
+    while(lo < hi) { // first block with tmin > et
+      int mid = (lo + hi) / 2;
+      if(ix_tmin(r, mid) <= et) {
+	lo = mid + 1;
+      } else {
+	hi = mid;
+      }
+    }
+    r->last = lo - 1;
+  }
+  return true;
+}
+
+// ix_wanted - might block i have rows we want
+static bool ix_wanted(struct bin_r* r, int i) {
+  if(r->hold) { // every block from next to last matters
+    return true;
+  }
+  if(!r->sorted && (ix_tmax(r, i) < r->st || ix_tmin(r, i) > r->et)) {
+    return false;
+  }
+  if(r->vmin > -INFINITY || r->vmax < INFINITY) {
+    int c;
+    for(c = 0; c < r->h.nv; c++) {
+      size_t off = 28 + 20 * c;
+      double lo = bitsd(ix_get(r, i, off, 8));
+      double hi = bitsd(ix_get(r, i, off + 8, 8));
+      if(ix_get(r, i, off + 16, 4) > 0 && lo <= r->vmax && hi >= r->vmin) {
+	return true;
+      }
+    }
+    return false;
+  }
+  return true;
+}
+
+int bin_r_block(struct bin_r* r, tms** t, double** v) {
+  uint8_t hdr[8];
+  size_t got;
+  if(r->ix != NULL) { // go straight to the next block we want
+    while(r->next <= r->last && !ix_wanted(r, r->next)) {
+      r->next++;
+    }
+    if(r->next > r->last) {
+      return 0;
+    }
+    rd_seek(r->in, r->base + ix_get(r, r->next++, 0, 8));
+  }
+  for(;;) {
+    if((got = rd_read(r->in, hdr, 4)) == 0) {
+      return 0;
+    } else if(got != 4) {
+      bin_corrupt("truncated block");
+    }
+    if(memcmp(hdr, BIN_INDEX, 4) == 0) { // skip the index
+      get(r, hdr, 8);
+      skip(r, get_le(hdr, 4) * IX_SIZE(get_le(hdr + 4, 4)) + 12);
+      continue;
+    }
+    if(memcmp(hdr, BIN_MAGIC, 4) != 0) {
+      break;
+    }
+    struct bin_hdr h; // another stream appended to this one
+    get_hdr(r, &h);
+    if(h.nv != r->h.nv) {
+      bin_corrupt("appended stream has a different number of values");
+    }
+    free_hdr(&h);
+  }
+  get(r, hdr + 4, 4);
+  int n = get_le(hdr, 4);
+  size_t nbytes = get_le(hdr + 4, 4);
+  if(n < 1 || n > BIN_ROWS) {
+    bin_corrupt("bad block size");
+  }
+  if(nbytes > r->size) {
+    r->size = nbytes;
+    free(r->buf);
+    r->buf = bin_alloc(nbytes);
+  }
+  get(r, r->buf, nbytes);
+
+  size_t off = 0;
+  int c;
+  for(c = -1; c < r->h.nv; c++) { // -1 is the times
+    if(off + 4 > nbytes) {
+      bin_corrupt("block too short");
+    }
+    size_t len = get_le(r->buf + off, 4);
+    off += 4;
+    if(off + len > nbytes) {
+      bin_corrupt("block too short");
+    }
+    struct ubits b = { r->buf + off, len, 0 };
+    if(c < 0) {
+      get_times(&b, r->t, n);
+    } else {
+      get_values(&b, &r->v[c * n], n);
+    }
+    off += len;
+  }
+  *t = r->t;
+  *v = r->v;
+  return n;
+}
+
+void bin_r_close(struct bin_r* r) {
+  free_hdr(&r->h);
+  free(r->buf);
+  free(r->v);
+  free(r);
+}
+
+#ifdef TEST
+#include <unistd.h>
+
+// write a few blocks of t,a,b to a file and read them back
+int main() {
+  char* labels[] = { "a", "b" };
+  struct bin_hdr h = { false, 1000, 2, labels };
+  char tmpl[] = "/tmp/tst-binXXXXXX";
+  int fd = mkstemp(tmpl);
+  wr_init(fd, "size");
+  struct bin_w* w = bin_w_open(&h);
+  int n = 3 * BIN_ROWS + 17;
+  int i;
+  for(i = 0; i < n; i++) {
+    tms t = 1400000000000L + i * 1000L + (i % 7 == 0 ? 3 : 0) +
+      (i == 5000 ? 100000000L : 0);
+    double v[2] = { 100 + (i / 10) * 0.5, sin(i / 100.0) };
+    bin_w_row(w, t, v);
+  }
+  bin_w_close(w);
+  wr_flush();
+  off_t size = lseek(fd, 0, SEEK_END);
+  close(fd);
+
+  struct rd* in = rd_open(tmpl);
+  struct bin_r* r = bin_r_open(in);
+  int bad = 0, m = 0, k;
+  tms* t;
+  double* v;
+  while((k = bin_r_block(r, &t, &v)) > 0) {
+    for(i = 0; i < k; i++, m++) {
+      tms et = 1400000000000L + m * 1000L + (m % 7 == 0 ? 3 : 0) +
+	(m >= 5000 ? 100000000L : 0) * (m == 5000);
+      if(t[i] != et || v[i] != 100 + (m / 10) * 0.5 ||
+	 v[k + i] != sin(m / 100.0)) {
+	bad++;
+      }
+    }
+  }
+  printf("%d rows in %ld bytes (%.1f bytes/row), %d bad\n",
+	 m, (long) size, (double) size / m, bad);
+  bin_r_close(r);
+  rd_close(in);
+
+  // the index should take us straight to the rows in st..et
+  tms st = 1400000000000L + 6000 * 1000L;
+  tms et = st + 1000 * 1000L;
+  in = rd_open(tmpl);
+  r = bin_r_open(in);
+  int sel = bin_r_select(r, st, et, -INFINITY, INFINITY, false);
+  int blocks = 0, inside = 0;
+  m = 0;
+  while((k = bin_r_block(r, &t, &v)) > 0) {
+    blocks++;
+    for(i = 0; i < k; i++, m++) {
+      inside += st <= t[i] && t[i] <= et;
+    }
+  }
+  printf("select %d: %d blocks %d rows %d in range\n",
+	 sel, blocks, m, inside);
+  bin_r_close(r);
+  rd_close(in);
+  unlink(tmpl);
+  return bad != 0 || m == n || inside != 1000 || blocks != 1;
+}
+#endif
@@ -0,0 +1,94 @@
+/*
+ * tst-bin.h - compressed binary time series format
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _TST_BIN_H_
+#define _TST_BIN_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "tst-t.h"
+#include "tst-read.h"
+
+// A binary file is a header followed by blocks of up to BIN_ROWS
+// rows, all little endian:
+//
+//   header: "TSTB" version:u8 delta:u8 0:u16 tsize:i64 nv:u32
+//           nv * (len:u16 label)
+//   block:  nrows:u32 nbytes:u32 then nbytes of
+//           tlen:u32 t stream, nv * (vlen:u32 v stream)
+//   index:  "TSTI" nblocks:u32 nv:u32 then per block
+//           off:u64 nrows:u32 tmin:i64 tmax:i64
+//           nv * (vmin:f64 vmax:f64 count:u32)
+//           and finally ixoff:u64 "TSTI"
+//
+// The t stream is the first time as 64 bits then delta-of-delta
+// codes, each v stream is the first value as 64 bits then Gorilla
+// style XOR codes against the previous value.  Streams (header and
+// blocks) may be concatenated, e.g. by -jobs, and lines starting
+// with # before the first header are skipped since tst writes its
+// options there just like it does for text.  The delta/tsize in
+// the header are how the time column was written in text, times
+// themselves are always absolute ms.  Offsets in the index are
+// from the start of the header, count is the number of values that
+// aren't NaN and vmin/vmax are taken over those.
+
+#define BIN_MAGIC "TSTB"
+#define BIN_INDEX "TSTI"
+#define BIN_VERSION 1
+#define BIN_ROWS 4096
+
+struct bin_hdr {
+  bool delta;
+  tms tsize;
+  int nv;
+  char** vlabels; // vlabels[0..nv-1]
+};
+
+// writing, the output goes through wr_mem
+struct bin_w;
+struct bin_w* bin_w_open(struct bin_hdr* h);
+void bin_w_row(struct bin_w* w, tms t, double* v);
+void bin_w_close(struct bin_w* w); // flush the last block
+
+// reading
+struct bin_r;
+bool bin_is(struct rd* in); // in starts with BIN_MAGIC
+struct bin_r* bin_r_open(struct rd* in);
+struct bin_hdr* bin_r_hdr(struct bin_r* r);
+bool bin_r_select(struct bin_r* r, tms st, tms et,
+		  double vmin, double vmax, bool hold);
+// decode the next block, *t is t[0..n-1] and *v is column by column
+// v[c*n + i], returns n or 0 at the end
+int bin_r_block(struct bin_r* r, tms** t, double** v);
+void bin_r_close(struct bin_r* r);
+
+#endif /* _TST_BIN_H_ */
@@ -0,0 +1,134 @@
+/*
+ * tst-gen.c - make up tst input files for benchmarking, the same
+ *   options always give the same file.
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "options.h"
+#include "tst-t.h"
+#include "tst-num.h"
+
+// xorshift64* so runs are repeatable everywhere
+static uint64_t seed;
+
+static uint64_t rnd() {
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  return seed * 2685821657736338717ULL;
+}
+
+static double uniform() { // [0, 1)
+  return (rnd() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int main(int argc, char** argv) {
+  init_options(argc, argv);
+  FILE* out = stdout; // the options are listed on stderr, not in the data
+  stdout = stderr;
+  long rows = option_long("-rows", "100000", "rows to write");
+  long cols = option_long("-cols", "4", "value columns per row");
+  char* topt = option("-t", "iso", "iso|ms|epoch|pi|delta timestamps");
+  tms every = option_period("-every", "1s", "time between rows");
+  double sparse = option_double("-sparse", "0",
+				"0..1 chance a row is missing and "
+				"a value doesn't move");
+  tms start = option_time("-start", "2015-01-01", "time of the first row");
+  seed = option_long("-seed", "1", "random number seed");
+  seed = seed * 0x9E3779B97F4A7C15ULL + 1; // never 0
+  stdout = out;
+
+  double* v = calloc(cols, sizeof(double));
+  char* buf = malloc(FMT_T_SIZE + cols * (FMT_V_SIZE + 1) + 64);
+  if(v == NULL || buf == NULL) {
+    fprintf(stderr, "%s: fatal out of memory for %ld columns\n",
+	    get_progname(), cols);
+    exit(12);
+  }
+  long c;
+  for(c = 0; c < cols; c++) {
+    v[c] = uniform() * 1000;
+  }
+
+  bool iso = strcmp(topt, "iso") == 0;
+  bool ms = strcmp(topt, "ms") == 0;
+  bool epoch = strcmp(topt, "epoch") == 0;
+  bool pi = strcmp(topt, "pi") == 0;
+  bool delta = strcmp(topt, "delta") == 0;
+  if(!iso && !ms && !epoch && !pi && !delta) {
+    fprintf(stderr, "%s: fatal unknown -t %s\n", get_progname(), topt);
+    exit(102);
+  }
+  printf("%s", ms ? "tms" : delta ? "dtms" : "t");
+  for(c = 0; c < cols; c++) {
+    printf(",v%ld", c);
+  }
+  printf("\n");
+
+  tms t = start, lt = 0; // a delta series starts with the absolute time
+  long i;
+  for(i = 0; i < rows; i++) {
+    while(sparse > 0 && uniform() < sparse) { // a gap
+      t += every;
+    }
+    char* p = buf;
+    if(iso) {
+      p += fmt_t_buf(t, p);
+    } else if(ms) {
+      p += sprintf(p, "%ld", t);
+    } else if(epoch) {
+      p += sprintf(p, "%ld", t / 1000);
+    } else if(pi) {
+      time_t secs = t / 1000;
+      struct tm tmb;
+      p += strftime(p, 64, "%d/%m/%Y %H:%M:%S %p", gmtime_r(&secs, &tmb));
+    } else {
+      p += sprintf(p, "%ld", t - lt);
+    }
+    for(c = 0; c < cols; c++) { // a random walk, mostly still if sparse
+      if(sparse == 0 || uniform() >= sparse) {
+	v[c] += (uniform() - 0.5) * 2;
+      }
+      *p++ = ',';
+      p += sprintf(p, "%.3f", v[c]);
+    }
+    *p++ = '\n';
+    fwrite(buf, 1, p - buf, stdout);
+    lt = t;
+    t += every;
+  }
+  return 0;
+}
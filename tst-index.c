@@ -0,0 +1,246 @@
+/*
+ * tst-index.c - sparse seek index for text inputs, every Nth row's
+ *   offset and time kept in a sidecar file next to the input.
+ *
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "tst-index.h"
+#include "tst-tz.h"
+
+static void* tsx_alloc(void* p, size_t n) {
+  if((p = realloc(p, n)) == NULL) {
+    fprintf(stderr, "tst: fatal out of memory in index\n");
+    exit(112);
+  }
+  return p;
+}
+
+// tail_hash - FNV-1a of the (up to) 64 bytes before end and the
+//   -tz zone if there is one, the times are different in another
+static unsigned long tail_hash(struct rd* in, size_t end) {
+  size_t n = end < 64 ? end : 64;
+  unsigned char* p = (unsigned char*) rd_at(in, end - n, n);
+  unsigned long h = 14695981039346656037UL;
+  size_t i;
+  for(i = 0; p != NULL && i < n; i++) {
+    h = (h ^ p[i]) * 1099511628211UL;
+  }
+  char* z = tz_name();
+  for(; strcmp(tz_name(), "UTC") != 0 && *z != '\0'; z++) {
+    h = (h ^ (unsigned char) *z) * 1099511628211UL;
+  }
+  return h;
+}
+
+static long file_mtime(char* filename) {
+  struct stat sb;
+  if(stat(filename, &sb) != 0) {
+    return 0;
+  }
+  return sb.st_mtim.tv_sec * 1000000000L + sb.st_mtim.tv_nsec;
+}
+
+static void add_entry(struct tsx* x, size_t off, tms t, tms base) {
+  if(x->n == x->size) {
+    x->size = x->size == 0 ? 256 : x->size * 2;
+    x->e = tsx_alloc(x->e, x->size * sizeof(struct tsx_entry));
+  }
+  x->e[x->n].off = off;
+  x->e[x->n].t = t;
+  x->e[x->n].base = base;
+  x->n++;
+}
+
+// load - read the index file into x, false if it isn't there or
+//   doesn't make sense
+static bool load(struct tsx* x, size_t size) {
+  FILE* fp = fopen(x->filename, "r");
+  if(fp == NULL) {
+    return false;
+  }
+  int version, sorted;
+  bool ok = fscanf(fp, "tsx,%d,%zu,%ld,%lu,%d,%ld,%ld,%d\n",
+		   &version, &x->end, &x->mtime, &x->hash, &x->every,
+		   &x->rows, &x->last_t, &sorted) == 8 &&
+    version == 1 && x->every > 0 && x->end <= size;
+  x->sorted = sorted;
+  size_t off;
+  tms t, base;
+  while(ok && fscanf(fp, "%zu,%ld,%ld\n", &off, &t, &base) == 3) {
+    if(off >= x->end || (x->n > 0 && off <= x->e[x->n - 1].off)) {
+      ok = false;
+    }
+    add_entry(x, off, t, base);
+  }
+  ok = ok && feof(fp) && x->n == (x->rows + x->every - 1) / x->every;
+  fclose(fp);
+  return ok;
+}
+
+struct tsx* tsx_open(char* filename, struct rd* in) {
+  size_t size = rd_size(in);
+  if(size == 0) {
+    return NULL;
+  }
+  struct tsx* x = tsx_alloc(NULL, sizeof(struct tsx));
+  memset(x, 0, sizeof(*x));
+  x->filename = tsx_alloc(NULL, strlen(filename) + 5);
+  sprintf(x->filename, "%s.tsx", filename);
+  long mtime = file_mtime(filename);
+  // hash now, reading writes terminators into the map
+  x->fsize = size;
+  x->fhash = tail_hash(in, size);
+  if(load(x, size) && x->hash == tail_hash(in, x->end) &&
+     (x->end < size || x->mtime == mtime)) {
+    x->fresh = x->end == size; // else it's been appended to
+    x->mtime = mtime;
+    return x;
+  }
+  x->mtime = mtime;
+  x->end = 0; // start again from scratch
+  x->n = 0;
+  x->rows = 0;
+  x->every = TSX_EVERY;
+  x->sorted = true;
+  return x;
+}
+
+void tsx_row(struct tsx* x, size_t off, tms t, tms base) {
+  if(off < x->end) {
+    return;
+  }
+  if(x->rows % x->every == 0) {
+    add_entry(x, off, t, base);
+  }
+  if(x->rows > 0 && t < x->last_t) {
+    x->sorted = false;
+  }
+  x->last_t = t;
+  x->rows++;
+  x->changed = true;
+}
+
+bool tsx_seek(struct tsx* x, tms st, size_t* off, tms* base) {
+  if(!x->sorted || x->n == 0) {
+    return false;
+  }
+  int lo = 0, hi = x->n; // find the first entry at or after st
+  while(lo < hi) {
+    int mid = (lo + hi) / 2;
+    if(x->e[mid].t < st) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if(lo <= 1) { // st is in the first stretch of rows
+    return false;
+  }
+  *off = x->e[lo - 1].off; // the last one before st
+  *base = x->e[lo - 1].base;
+  return true;
+}
+
+void tsx_close(struct tsx* x, bool complete) {
+  if(complete && x->changed) { // write it out and swap it in
+    char* tmp = tsx_alloc(NULL, strlen(x->filename) + 5);
+    sprintf(tmp, "%s.tmp", x->filename);
+    FILE* fp = fopen(tmp, "w");
+    if(fp != NULL) {
+      fprintf(fp, "tsx,1,%zu,%ld,%lu,%d,%ld,%ld,%d\n",
+	      x->fsize, x->mtime, x->fhash, x->every,
+	      x->rows, x->last_t, x->sorted);
+      int i;
+      for(i = 0; i < x->n; i++) {
+	fprintf(fp, "%zu,%ld,%ld\n", x->e[i].off, x->e[i].t, x->e[i].base);
+      }
+      if(fclose(fp) != 0 || rename(tmp, x->filename) != 0) {
+	remove(tmp); // no index is better than a bad one
+      }
+    }
+    free(tmp);
+  }
+  free(x->filename);
+  free(x->e);
+  free(x);
+}
+
+#ifdef TEST
+// index a file of t,v rows then seek in it
+int main() {
+  char tmpl[] = "/tmp/tst-indexXXXXXX";
+  int fd = mkstemp(tmpl);
+  FILE* fp = fdopen(fd, "w");
+  int n = 10000, i;
+  fprintf(fp, "t1ms,v\n");
+  for(i = 0; i < n; i++) {
+    fprintf(fp, "%d,%d\n", i * 10, i);
+  }
+  fclose(fp);
+
+  int bad = 0, pass;
+  for(pass = 0; pass < 2; pass++) { // build then use it
+    struct rd* in = rd_open(tmpl);
+    struct tsx* x = tsx_open(tmpl, in);
+    if(x->fresh != (pass == 1)) {
+      bad++;
+    }
+    size_t len, off = rd_tell(in);
+    char* s = rd_line(in, &len); // header
+    while((off = rd_tell(in), s = rd_line(in, &len)) != NULL) {
+      tsx_row(x, off, atol(s), 0);
+    }
+    tms base;
+    if(!tsx_seek(x, 50005, &off, &base)) {
+      bad++;
+    } else {
+      rd_seek(in, off);
+      s = rd_line(in, &len);
+      long t = atol(s);
+      printf("pass %d: %d entries, seek 50005 lands on t = %ld\n",
+	     pass, x->n, t);
+      bad += !(t <= 50005 && 50005 - t < TSX_EVERY * 10);
+    }
+    tsx_close(x, true);
+    rd_close(in);
+  }
+  char* ix = malloc(strlen(tmpl) + 5);
+  sprintf(ix, "%s.tsx", tmpl);
+  remove(ix);
+  remove(tmpl);
+  printf("%d bad\n", bad);
+  return bad != 0;
+}
+#endif
@@ -0,0 +1,94 @@
+/*
+ * tst-index.h - sparse seek index for text inputs
+ *
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TST_INDEX_H_
+#define _TST_INDEX_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "tst-t.h"
+#include "tst-read.h"
+
+// The index for file.csv lives in file.csv.tsx and holds the byte
+// offset of every TSX_EVERY'th row with its time t and the time
+// before it (base) for delta encoded files.  It is text:
+//
+//   tsx,1,size,mtime,hash,every,rows,last_t,sorted
+//   off,t,base
+//   ...
+//
+// size/mtime are the file when the index was written, hash is of
+// the last (up to) 64 bytes before size so a file that has only
+// been appended to keeps its entries and the index is extended
+// from where it stopped.  sorted is true if no row went back in
+// time, only then can tsx_seek skip rows and -et stop early.
+
+#define TSX_EVERY 1024
+
+struct tsx_entry {
+  size_t off;
+  tms t;
+  tms base;
+};
+
+struct tsx {
+  char* filename; // the index file
+  size_t end; // rows before this offset are already indexed
+  bool fresh; // and that's the whole file
+  bool changed; // rows have been added
+  unsigned long hash; // of the file just before end
+  long mtime;
+  size_t fsize; // the file now
+  unsigned long fhash; // and its hash
+  int every;
+  long rows; // rows indexed
+  tms last_t; // time of the last one
+  bool sorted;
+  int n; // entries in e
+  int size;
+  struct tsx_entry* e;
+};
+
+// tsx_open - the index of filename (open as in) if it is still good
+//   or an empty one to build, NULL if in isn't a mapped file.
+struct tsx* tsx_open(char* filename, struct rd* in);
+// tsx_row - tell the index about the row at off, rows before end
+//   are ignored so it can be called for every row read.
+void tsx_row(struct tsx* x, size_t off, tms t, tms base);
+// tsx_seek - where to start reading for rows at st or later, false
+//   if there is nothing to skip.
+bool tsx_seek(struct tsx* x, tms st, size_t* off, tms* base);
+// tsx_close - save the index if complete (we read to the end of
+//   the file) and rows were added, then free it.
+void tsx_close(struct tsx* x, bool complete);
+
+#endif /* _TST_INDEX_H_ */
@@ -0,0 +1,358 @@
+/*
+ * tst-num.c - fast exact conversion of values to and from text,
+ *   parsing falls back to strtod and printing to snprintf.
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "tst-num.h"
+
+// exact powers of ten as doubles, 10^22 is the largest
+static const double p10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define TWO53 9007199254740992.0 // 2^53, doubles are exact below it
+
+static inline int isws(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// parse_v - parse the number in s into *v returning false if s
+//   isn't a number (empty, trailing junk ...).  Decimals with at
+//   most 19 significant digits whose mantissa fits in 53 bits and
+//   whose exponent is within 10^22 are done exactly with one
+//   multiply or divide (Clinger's fast path), anything else goes
+//   to strtod so the result is always correctly rounded.
+bool parse_v(char* s, double* v) {
+  char* p = s;
+  while(isws(*p)) {
+    p++;
+  }
+  bool neg = false;
+  if(*p == '-' || *p == '+') {
+    neg = *p++ == '-';
+  }
+
+  uint64_t m = 0; // significant digits
+  int nd = 0; // digits in m
+  int e = 0; // decimal exponent to apply to m
+  bool any = false; // saw a digit
+  for(; (unsigned) (*p - '0') <= 9; p++) {
+    any = true;
+    if(nd < 19) {
+      if(m != 0 || *p != '0') {
+	m = m * 10 + (*p - '0');
+	nd += m != 0;
+      }
+    } else {
+      e++; // digits we couldn't keep
+    }
+  }
+  if(*p == '.') {
+    p++;
+    for(; (unsigned) (*p - '0') <= 9; p++) {
+      any = true;
+      if(nd < 19) {
+	if(m != 0 || *p != '0') {
+	  m = m * 10 + (*p - '0');
+	  nd += m != 0;
+	}
+	e--;
+      }
+    }
+  }
+  if(!any) {
+    goto slow; // nan, inf or rubbish
+  }
+  if(*p == 'e' || *p == 'E') {
+    p++;
+    bool eneg = false;
+    if(*p == '-' || *p == '+') {
+      eneg = *p++ == '-';
+    }
+    if((unsigned) (*p - '0') > 9) {
+      return false;
+    }
+    int x = 0;
+    for(; (unsigned) (*p - '0') <= 9; p++) {
+      if(x < 100000) {
+	x = x * 10 + (*p - '0');
+      }
+    }
+    e += eneg ? -x : x;
+  }
+  while(isws(*p)) {
+    p++;
+  }
+  if(*p != '\0') {
+    return false;
+  }
+  if(nd >= 19 || m > (uint64_t) TWO53 || e < -22 || e > 22) {
+    goto slow;
+  }
+  double d = (double) m;
+  d = e < 0 ? d / p10[-e] : d * p10[e];
+  *v = neg ? -d : d;
+  return true;
+
+ slow: ;
+  char* endp;
+  *v = strtod(s, &endp);
+  if(endp == s) {
+    return false;
+  }
+  while(isws(*endp)) {
+    endp++;
+  }
+  return *endp == '\0';
+}
+
+// shortest_fixed - find the fewest decimal places k <= 17 so that
+//   r / 10^k reads back as a (a > 0), false if there aren't any
+//   with r below 2^53 in which case the caller falls back.
+static bool shortest_fixed(double a, uint64_t* r, int* k) {
+  int i;
+  for(i = 0; i <= 17; i++) {
+    double m = a * p10[i];
+    if(m >= TWO53) {
+      return false;
+    }
+    double n = nearbyint(m);
+    if(n != 0 && n / p10[i] == a) {
+      *r = (uint64_t) n;
+      *k = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// put_digits - the digits of r into buf, returning how many
+static int put_digits(uint64_t r, char* buf) {
+  char tmp[24];
+  int n = 0;
+  do {
+    tmp[n++] = '0' + r % 10;
+    r /= 10;
+  } while(r != 0);
+  int i;
+  for(i = 0; i < n; i++) {
+    buf[i] = tmp[n - 1 - i];
+  }
+  return n;
+}
+
+// put_decimal - write the value digits[0..nd-1] * 10^(x-nd+1),
+//   i.e. x is the exponent of the first digit, in fixed notation if
+//   lo <= x < hi otherwise as d.ddde+XX like printf.
+static int put_decimal(char* buf, bool neg, char* digits, int nd, int x,
+		       int lo, int hi) {
+  char* p = buf;
+  if(neg) {
+    *p++ = '-';
+  }
+  if(x < lo || x >= hi) {
+    *p++ = digits[0];
+    if(nd > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, nd - 1);
+      p += nd - 1;
+    }
+    *p++ = 'e';
+    *p++ = x < 0 ? '-' : '+';
+    int ax = x < 0 ? -x : x;
+    if(ax >= 100) {
+      *p++ = '0' + ax / 100;
+      ax %= 100;
+    }
+    *p++ = '0' + ax / 10;
+    *p++ = '0' + ax % 10;
+  } else if(x < 0) { // 0.000ddd
+    *p++ = '0';
+    *p++ = '.';
+    int i;
+    for(i = -1; i > x; i--) {
+      *p++ = '0';
+    }
+    memcpy(p, digits, nd);
+    p += nd;
+  } else if(nd <= x + 1) { // ddd000
+    memcpy(p, digits, nd);
+    p += nd;
+    int i;
+    for(i = nd; i <= x; i++) {
+      *p++ = '0';
+    }
+  } else { // ddd.ddd
+    memcpy(p, digits, x + 1);
+    p += x + 1;
+    *p++ = '.';
+    memcpy(p, digits + x + 1, nd - x - 1);
+    p += nd - x - 1;
+  }
+  return p - buf;
+}
+
+// fmt_num - the shortest decimal of v if it has at most maxd
+//   significant digits laid out like %g (fixed when lo <= x < hi),
+//   or -1.
+static int fmt_num(double v, char* buf, int maxd, int lo, int hi) {
+  bool neg = signbit(v);
+  double a = neg ? -v : v;
+  if(a == 0) {
+    return put_decimal(buf, neg, "0", 1, 0, lo, hi);
+  }
+  if(!isfinite(a)) {
+    return -1;
+  }
+  uint64_t r;
+  int k;
+  if(!shortest_fixed(a, &r, &k)) {
+    return -1;
+  }
+  char digits[24];
+  int n = put_digits(r, digits);
+  int x = n - 1 - k; // exponent of the first digit
+  while(n > 1 && digits[n - 1] == '0') { // only when k == 0
+    n--;
+  }
+  if(n > maxd) {
+    return -1;
+  }
+  return put_decimal(buf, neg, digits, n, x, lo, hi);
+}
+
+// fmt_g - v exactly as printf("%g") would write it into buf (which
+//   must hold FMT_V_SIZE bytes), returning the length.  When the
+//   shortest decimal that reads back as v has 6 or fewer digits it
+//   is also what %g rounds to, so only the others need snprintf.
+int fmt_g(double v, char* buf) {
+  int n = fmt_num(v, buf, 6, -4, 6);
+  if(n < 0) {
+    n = snprintf(buf, FMT_V_SIZE, "%g", v);
+  }
+  return n;
+}
+
+// fmt_shortest - the shortest decimal that reads back as exactly v
+int fmt_shortest(double v, char* buf) {
+  int n = fmt_num(v, buf, 17, -5, 17);
+  if(n < 0) { // binary search for the fewest digits, 17 always works
+    int lo = 1, hi = 17;
+    while(lo < hi) {
+      int p = (lo + hi) / 2;
+      n = snprintf(buf, FMT_V_SIZE, "%.*g", p, v);
+      if(strtod(buf, NULL) == v || isnan(v)) {
+	hi = p;
+      } else {
+	lo = p + 1;
+      }
+    }
+    n = snprintf(buf, FMT_V_SIZE, "%.*g", lo, v);
+  }
+  return n;
+}
+
+#ifdef TEST
+int main() {
+  char* tests[] = {
+    "0", "-0", "1", "1.5", "  42  ", "100", "1e3", "1.25e-3",
+    "0.1", "123456.7", "1234567", "9007199254740993",
+    "3.141592653589793238", "1e-320", "1e400", "nan", "-inf",
+    "", "x", "1,2", "1e", "--1", ".", ".5", "5.",
+    NULL
+  };
+  int i;
+  for(i = 0; tests[i] != NULL; i++) {
+    double v;
+    char g[FMT_V_SIZE + 1], sh[FMT_V_SIZE + 1];
+    if(parse_v(tests[i], &v)) {
+      g[fmt_g(v, g)] = '\0';
+      sh[fmt_shortest(v, sh)] = '\0';
+      printf("'%s' -> %%g %s shortest %s\n", tests[i], g, sh);
+    } else {
+      printf("'%s' -> bad\n", tests[i]);
+    }
+  }
+
+  // check against strtod and printf on random values
+  srandom(1);
+  int bad = 0;
+  for(i = 0; i < 1000000; i++) {
+    char s[64], g[FMT_V_SIZE + 1], sh[FMT_V_SIZE + 1], ref[64];
+    switch(i % 4) {
+    case 0:
+      snprintf(s, sizeof(s), "%ld.%02ld", random() % 100000, random() % 100);
+      break;
+    case 1:
+      snprintf(s, sizeof(s), "%.*g", (int) (random() % 17) + 1,
+	       (random() - RAND_MAX / 2) / (double) (random() + 1));
+      break;
+    case 2:
+      snprintf(s, sizeof(s), "%de%d", (int) (random() % 1000),
+	       (int) (random() % 60) - 30);
+      break;
+    default: {
+      uint64_t u = ((uint64_t) random() << 33) ^ ((uint64_t) random() << 2);
+      double d;
+      memcpy(&d, &u, sizeof(d));
+      if(!isfinite(d)) {
+	d = 1;
+      }
+      snprintf(s, sizeof(s), "%.17g", d);
+    }
+    }
+    double v;
+    if(!parse_v(s, &v) || v != strtod(s, NULL)) {
+      printf("parse_v('%s') wrong\n", s);
+      bad++;
+    }
+    g[fmt_g(v, g)] = '\0';
+    snprintf(ref, sizeof(ref), "%g", v);
+    if(strcmp(g, ref) != 0) {
+      printf("fmt_g(%s) = %s not %s\n", s, g, ref);
+      bad++;
+    }
+    sh[fmt_shortest(v, sh)] = '\0';
+    if(strtod(sh, NULL) != v) {
+      printf("fmt_shortest(%s) = %s doesn't read back\n", s, sh);
+      bad++;
+    }
+  }
+  printf("%d bad\n", bad);
+  return bad != 0;
+}
+#endif
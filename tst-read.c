@@ -0,0 +1,319 @@
+/*
+ * tst-read.c - line reader for tst input files, regular files
+ *   are memory mapped read only and lines copied out one at a time.
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "tst-read.h"
+#include "tst-z.h"
+
+// how far ahead of the current line we ask the kernel to read
+#define RD_AHEAD (4 * 1024 * 1024)
+
+struct rd {
+  FILE* fp;      // stdio stream if not mapped
+  char* buf;     // getline buffer for fp
+  size_t bufsz;
+
+  char* map;     // the mapped file
+  size_t size;   // and its size
+  size_t mapsz;  // size rounded up to whole pages
+  char* cur;     // next unread byte in map
+  char* ahead;   // we've asked for readahead up to here
+  bool follow;   // the file is growing, only return whole lines
+  size_t got;    // bytes read through fp
+};
+
+// rd_stream - fd through stdio, decompressed if it starts with
+//   a gzip or zstd magic number
+static FILE* rd_stream(int fd) {
+  char magic[4];
+  ssize_t n = 0, k;
+  while(n < 4 && ((k = read(fd, magic + n, 4 - n)) > 0 ||
+		  (k < 0 && errno == EINTR))) {
+    n += k > 0 ? k : 0;
+  }
+  return z_read(fd, z_codec((unsigned char*) magic, n), magic, n);
+}
+
+struct rd* rd_open(char* filename) {
+  struct rd* r = calloc(1, sizeof(*r));
+  if(r == NULL) {
+    return NULL;
+  }
+  if(strcmp(filename, "-") == 0) {
+    r->fp = rd_stream(0);
+    return r;
+  }
+
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) {
+    free(r);
+    return NULL;
+  }
+  struct stat sb;
+  unsigned char magic[4];
+  ssize_t n;
+  bool reg = fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0;
+  if(reg && (n = pread(fd, magic, 4, 0)) > 0 &&
+     z_codec(magic, n) != Z_PLAIN) { // compressed so stream it
+    r->fp = z_read(fd, z_codec(magic, n), NULL, 0);
+    return r;
+  }
+  if(reg) {
+    long pg = sysconf(_SC_PAGESIZE);
+    r->size = sb.st_size;
+    r->mapsz = (r->size + pg - 1) / pg * pg;
+    // read only so the pages stay in the page cache rather than
+    // being copied, lines are copied out to be split
+    r->map = mmap(NULL, r->mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(r->map != MAP_FAILED) {
+      close(fd);
+      madvise(r->map, r->mapsz, MADV_SEQUENTIAL);
+      r->cur = r->ahead = r->map;
+      return r;
+    }
+    r->map = NULL;
+  }
+  // not mappable (fifo, /dev/stdin, empty file ...) so use stdio
+  r->fp = rd_stream(fd);
+  return r;
+}
+
+// rd_follow - open a plain file that is still being written at
+//   offset off, lines are only returned once their '\n' arrives.
+struct rd* rd_follow(char* filename, size_t off) {
+  struct rd* r = calloc(1, sizeof(*r));
+  if(r == NULL) {
+    return NULL;
+  }
+  if((r->fp = fopen(filename, "r")) == NULL ||
+     fseeko(r->fp, off, SEEK_SET) != 0) {
+    if(r->fp != NULL) {
+      fclose(r->fp);
+    }
+    free(r);
+    return NULL;
+  }
+  r->follow = true;
+  return r;
+}
+
+// rd_line - return the next line without its '\n' and set *len,
+//   the line is writable and valid until the next call.
+char* rd_line(struct rd* r, size_t* len) {
+  if(r->map == NULL) { // stdio
+    off_t at = 0;
+    if(r->follow) { // forget the last EOF, more may have arrived
+      clearerr(r->fp);
+      at = ftello(r->fp);
+    }
+    ssize_t n = getline(&r->buf, &r->bufsz, r->fp);
+    if(n < 0) {
+      return NULL;
+    }
+    if(r->follow && r->buf[n-1] != '\n') { // not all here yet
+      fseeko(r->fp, at, SEEK_SET);
+      return NULL;
+    }
+    r->got += n;
+    if(n > 0 && r->buf[n-1] == '\n') {
+      r->buf[--n] = '\0';
+    }
+    *len = n;
+    return r->buf;
+  }
+
+  char* end = r->map + r->size;
+  if(r->cur >= end) {
+    return NULL;
+  }
+  if(r->cur >= r->ahead) { // keep the kernel ahead of us
+    size_t n = end - r->ahead;
+    if(n > RD_AHEAD) {
+      n = RD_AHEAD;
+    }
+    long pg = sysconf(_SC_PAGESIZE);
+    char* a = r->map + (r->ahead - r->map) / pg * pg;
+    madvise(a, n + (r->ahead - a), MADV_WILLNEED);
+    r->ahead += n;
+  }
+
+  char* s = r->cur;
+  char* nl = memchr(s, '\n', end - s);
+  if(nl == NULL) { // the last line has no '\n'
+    nl = end;
+  }
+  r->cur = nl < end ? nl + 1 : end;
+  *len = nl - s;
+  if(*len + 1 > r->bufsz) {
+    size_t n = 2 * (*len + 1);
+    char* b = realloc(r->buf, n);
+    if(b == NULL) {
+      return NULL;
+    }
+    r->buf = b;
+    r->bufsz = n;
+  }
+  memcpy(r->buf, s, *len);
+  r->buf[*len] = '\0';
+  return r->buf;
+}
+
+// rd_chunk - hand out the next unread part of a mapped file as one
+//   block of whole lines for parsing elsewhere.  The block is cut
+//   just after a '\n' at or past max bytes, the last line of the
+//   file may not have one.
+char* rd_chunk(struct rd* r, size_t max, size_t* len) {
+  if(r->map == NULL) {
+    return NULL;
+  }
+  char* end = r->map + r->size;
+  char* s = r->cur;
+  if(s >= end) {
+    return NULL;
+  }
+  char* e = end;
+  if((size_t) (end - s) > max) {
+    char* nl = memchr(s + max, '\n', end - (s + max));
+    if(nl != NULL) {
+      e = nl + 1;
+    }
+  }
+  long pg = sysconf(_SC_PAGESIZE);
+  madvise(r->map + (s - r->map) / pg * pg,
+	  e - s + (s - r->map) % pg, MADV_WILLNEED);
+  r->cur = e;
+  if(r->ahead < e) {
+    r->ahead = e;
+  }
+  *len = e - s;
+  return s;
+}
+
+// rd_peek - the next n bytes of a mapped file without using them
+char* rd_peek(struct rd* r, size_t n) {
+  if(r->map == NULL || (size_t) (r->map + r->size - r->cur) < n) {
+    return NULL;
+  }
+  return r->cur;
+}
+
+// rd_read - copy up to n raw bytes into buf, returning how many
+size_t rd_read(struct rd* r, void* buf, size_t n) {
+  if(r->map == NULL) {
+    n = fread(buf, 1, n, r->fp);
+    r->got += n;
+    return n;
+  }
+  size_t left = r->map + r->size - r->cur;
+  if(n > left) {
+    n = left;
+  }
+  memcpy(buf, r->cur, n);
+  r->cur += n;
+  return n;
+}
+
+int rd_peekc(struct rd* r) {
+  if(r->map == NULL) {
+    return ungetc(getc(r->fp), r->fp);
+  }
+  return r->cur < r->map + r->size ? (unsigned char) *r->cur : EOF;
+}
+
+size_t rd_tell(struct rd* r) {
+  return r->map == NULL ? (size_t) ftell(r->fp) : (size_t) (r->cur - r->map);
+}
+
+size_t rd_bytes(struct rd* r) {
+  return r->map == NULL ? r->got : (size_t) (r->cur - r->map);
+}
+
+size_t rd_size(struct rd* r) {
+  return r->map == NULL ? 0 : r->size;
+}
+
+char* rd_at(struct rd* r, size_t off, size_t n) {
+  if(r->map == NULL || off > r->size || r->size - off < n) {
+    return NULL;
+  }
+  return r->map + off;
+}
+
+void rd_seek(struct rd* r, size_t off) {
+  if(r->map != NULL) {
+    r->cur = r->map + (off < r->size ? off : r->size);
+    r->ahead = r->cur;
+  } else if(r->follow) {
+    fseeko(r->fp, off, SEEK_SET);
+  }
+}
+
+void rd_close(struct rd* r) {
+  if(r->map != NULL) {
+    munmap(r->map, r->mapsz);
+  } else {
+    fclose(r->fp);
+  }
+  free(r->buf);
+  free(r);
+}
+
+#ifdef TEST
+int main(int argc, char* argv[]) {
+  int i;
+  for(i = 1; i < argc; i++) {
+    struct rd* r = rd_open(argv[i]);
+    if(r == NULL) {
+      perror(argv[i]);
+      continue;
+    }
+    char* s;
+    size_t len;
+    long n = 0;
+    while((s = rd_line(r, &len)) != NULL) {
+      printf("%s:%ld %zu '%s'\n", argv[i], ++n, len, s);
+    }
+    rd_close(r);
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,66 @@
+/*
+ * tst-read.h - line reader for tst input files
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TST_READ_H_
+#define _TST_READ_H_ 1
+
+#include <stddef.h>
+
+// an open input, regular files are mmap'd read only and each line
+// is copied out of the map, anything else (pipes, stdin) goes
+// through getline
+struct rd;
+
+struct rd* rd_open(char* filename); // "-" is stdin, NULL on failure
+// a plain file that is still growing read from off onwards, rd_line
+// returns NULL at a partial last line and can be called again later
+struct rd* rd_follow(char* filename, size_t off);
+// the next line without its '\n', writable and valid until the next
+// call, NULL at end of file
+char* rd_line(struct rd* r, size_t* len);
+// the next max or so bytes of a mapped file ending on a line
+// boundary, NULL if there are none or r isn't mapped.  They're in
+// the map so read only, copy them to split them.
+char* rd_chunk(struct rd* r, size_t max, size_t* len);
+// raw bytes for binary input, rd_peek only works on mapped files
+char* rd_peek(struct rd* r, size_t n); // NULL if not n bytes left
+size_t rd_read(struct rd* r, void* buf, size_t n); // bytes read
+int rd_peekc(struct rd* r); // next byte or EOF, not used up
+// random access to mapped files, rd_at is NULL if r isn't mapped
+// or off..off+n-1 is outside the file
+size_t rd_tell(struct rd* r); // offset of the next unread byte
+size_t rd_size(struct rd* r); // 0 if not mapped
+size_t rd_bytes(struct rd* r); // read so far, for -stats
+char* rd_at(struct rd* r, size_t off, size_t n);
+void rd_seek(struct rd* r, size_t off); // mapped or followed files
+void rd_close(struct rd* r);
+
+#endif /* _TST_READ_H_ */
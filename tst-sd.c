@@ -0,0 +1,203 @@
+/*
+ * tst-sd.c - swinging door compression, keep the samples needed to
+ *   draw the series within a deviation using straight lines.
+ *
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "tst-sd.h"
+
+struct sd {
+  int nv;
+  double dev;
+  tms max;
+  bool kept; // ta,va is the last row kept
+  bool held; // tp,vp is the row after it we haven't kept yet
+  tms ta;
+  double* va;
+  tms tp;
+  double* vp;
+  double* up; // up[i] steepest slope from va[i] + dev to a sample
+  double* lo; // lo[i] shallowest slope from va[i] - dev to a sample
+};
+
+struct sd* sd_new(int nv, double dev, tms max) {
+  struct sd* s = calloc(1, sizeof(struct sd));
+  if(s == NULL || (s->va = calloc(4 * nv + 1, sizeof(double))) == NULL) {
+    fprintf(stderr, "tst: fatal out of memory for -sd\n");
+    exit(118);
+  }
+  s->nv = nv;
+  s->dev = dev;
+  s->max = max;
+  s->vp = s->va + nv;
+  s->up = s->vp + nv;
+  s->lo = s->up + nv;
+  return s;
+}
+
+void sd_free(struct sd* s) {
+  free(s->va);
+  free(s);
+}
+
+// keep - t,v is kept so the doors swing from it now
+static void keep(struct sd* s, tms t, double* v, emit_fn emit, void* arg) {
+  emit(arg, t, v);
+  s->kept = true;
+  s->ta = t;
+  memcpy(s->va, v, s->nv * sizeof(double));
+  int i;
+  for(i = 0; i < s->nv; i++) {
+    s->up[i] = -INFINITY;
+    s->lo[i] = INFINITY;
+  }
+}
+
+// closes - would a line to t,v miss a sample since the last row kept
+//   in any column, the doors narrow to take in t,v either way
+static bool closes(struct sd* s, tms t, double* v) {
+  bool shut = false;
+  int i;
+  for(i = 0; i < s->nv; i++) {
+    double a = s->va[i], x = v[i];
+    if(isnan(a) || isnan(x)) {
+      shut |= isnan(a) != isnan(x);
+      continue;
+    }
+    if(t <= s->ta) { // no time to swing in
+      shut |= fabs(x - a) > s->dev;
+      continue;
+    }
+    // the line from va to x must pass within dev of every sample
+    // since, i.e. its slope must be inside the doors
+    double dt = t - s->ta;
+    double slope = (x - a) / dt;
+    shut |= slope < s->up[i] || slope > s->lo[i];
+    double up = slope - s->dev / dt;
+    double lo = slope + s->dev / dt;
+    s->up[i] = up > s->up[i] ? up : s->up[i];
+    s->lo[i] = lo < s->lo[i] ? lo : s->lo[i];
+  }
+  return shut;
+}
+
+void sd_add(struct sd* s, tms t, double* v, emit_fn emit, void* arg) {
+  if(!s->kept) { // the first one is always kept
+    keep(s, t, v, emit, arg);
+    return;
+  }
+  if(s->held && ((s->max > 0 && t - s->ta > s->max) || closes(s, t, v))) {
+    keep(s, s->tp, s->vp, emit, arg); // the last row that fitted
+    closes(s, t, v); // and swing the new doors to t,v
+  } else if(!s->held) {
+    closes(s, t, v);
+  }
+  s->held = true;
+  s->tp = t;
+  memcpy(s->vp, v, s->nv * sizeof(double));
+}
+
+void sd_end(struct sd* s, emit_fn emit, void* arg) {
+  if(s->held) {
+    keep(s, s->tp, s->vp, emit, arg);
+    s->held = false;
+  }
+}
+
+// sd_save - the doors and the rows they hang on as text for -follow
+void sd_save(struct sd* s, FILE* fp) {
+  fprintf(fp, "sd %d %d %ld %ld\n", s->kept, s->held, s->ta, s->tp);
+  int i;
+  for(i = 0; i < s->nv; i++) {
+    fprintf(fp, "%a %a %a %a\n", s->va[i], s->vp[i], s->up[i], s->lo[i]);
+  }
+}
+
+bool sd_load(struct sd* s, FILE* fp) {
+  int kept, held;
+  if(fscanf(fp, " sd %d %d %ld %ld", &kept, &held, &s->ta, &s->tp) != 4) {
+    return false;
+  }
+  s->kept = kept;
+  s->held = held;
+  int i;
+  for(i = 0; i < s->nv; i++) {
+    if(fscanf(fp, "%la %la %la %la",
+	      &s->va[i], &s->vp[i], &s->up[i], &s->lo[i]) != 4) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef TEST
+static int n;
+static tms kt[100];
+static double kv[100];
+
+static void save(void* arg, tms t, double* v) {
+  kt[n] = t;
+  kv[n++] = v[0];
+}
+
+// a triangle wave with a little noise should come down to its corners
+int main() {
+  struct sd* s = sd_new(1, 0.5, 0);
+  double noise[] = { 0.1, -0.2, 0.3, 0, -0.1 };
+  int i, bad = 0;
+  for(i = 0; i <= 400; i++) {
+    double v = (i % 200 < 100 ? i % 200 : 200 - i % 200) + noise[i % 5];
+    sd_add(s, i * 1000L, &v, save, NULL);
+  }
+  sd_end(s, save, NULL);
+  for(i = 0; i < n; i++) {
+    printf("%ld %g\n", kt[i], kv[i]);
+  }
+  // every sample must be within 0.5 of the line through the kept ones
+  int k = 0;
+  for(i = 0; i <= 400; i++) {
+    double v = (i % 200 < 100 ? i % 200 : 200 - i % 200) + noise[i % 5];
+    tms t = i * 1000L;
+    while(k + 1 < n - 1 && kt[k + 1] < t) {
+      k++;
+    }
+    double l = kv[k] + (kv[k + 1] - kv[k]) * (t - kt[k]) / (kt[k + 1] - kt[k]);
+    bad += fabs(l - v) > 0.5 + 1e-9;
+  }
+  printf("%d kept, %d bad\n", n, bad);
+  return bad != 0 || n > 10;
+}
+#endif
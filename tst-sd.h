@@ -0,0 +1,61 @@
+/*
+ * tst-sd.h - swinging door compression
+ *
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TST_SD_H_
+#define _TST_SD_H_ 1
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "tst-t.h"
+
+// Swinging door keeps few samples such that the straight lines
+// between the kept ones are never more than dev away from a sample
+// that was dropped.  Each column has a pair of doors hinged dev above
+// and below the last kept value which narrow with every sample, a
+// row is kept when the line to the next sample would fall outside
+// the doors of any column (or max ms have passed, if max isn't 0).
+// That is decided by the sample after it so rows reach emit one
+// sample late.  NaN only matches NaN.
+
+struct sd;
+
+struct sd* sd_new(int nv, double dev, tms max);
+void sd_free(struct sd* s);
+void sd_add(struct sd* s, tms t, double* v, emit_fn emit, void* arg);
+void sd_end(struct sd* s, emit_fn emit, void* arg); // keep the last one
+// the state between samples as text, sd_load is false if fp
+// doesn't hold what sd_save wrote for the same nv
+void sd_save(struct sd* s, FILE* fp);
+bool sd_load(struct sd* s, FILE* fp);
+
+#endif /* _TST_SD_H_ */
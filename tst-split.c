@@ -30,37 +30,130 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPLIT_X86 1
+#endif
+
 #include "tst-split.h"
-// split a string
-static char *fields[100];
-static int nfields;
 
-int split_csv(char *s) {
-  nfields = 0;
-  fields[0] = s;
-  for(;;) {
-    // printf("split_csv processing %s\n", s);
-    if(*s == '\0') { // end of string
-      return ++nfields;
-    } else if(*s == ',') { // new field
-      *s = '\0'; // terminate old one
-      fields[++nfields] = ++s; 
-    } else { // keep moving
-      s++;
+// add field f to fs growing it as needed
+static inline void add_field(struct fields* fs, char* f) {
+  if(fs->n == fs->size) {
+    fs->size = fs->size == 0 ? 16 : fs->size * 2;
+    if((fs->f = realloc(fs->f, fs->size * sizeof(char*))) == NULL) {
+      fprintf(stderr, "tst: fatal out of memory splitting fields\n");
+      exit(105);
     }
   }
+  fs->f[fs->n++] = f;
+}
+
+// split_scalar - split s[i..len-1] a byte at a time
+static int split_scalar(struct fields* fs, char* s, size_t i, size_t len,
+			char sep) {
+  for(; i < len; i++) {
+    if(s[i] == sep) { // new field
+      s[i] = '\0'; // terminate old one
+      add_field(fs, s + i + 1);
+    }
+  }
+  return fs->n;
+}
+
+#ifdef SPLIT_X86
+// terminate the fields found at s[i + bit] for each bit in mask
+static inline void split_mask(struct fields* fs, char* s, size_t i,
+			      unsigned mask) {
+  while(mask != 0) {
+    size_t j = i + __builtin_ctz(mask);
+    s[j] = '\0';
+    add_field(fs, s + j + 1);
+    mask &= mask - 1;
+  }
+}
+
+// 16 bytes at a time, every x86_64 has sse2
+__attribute__((target("sse2")))
+static int split_sse2(struct fields* fs, char* s, size_t len, char sep) {
+  __m128i vsep = _mm_set1_epi8(sep);
+  size_t i;
+  for(i = 0; i + 16 <= len; i += 16) {
+    __m128i b = _mm_loadu_si128((__m128i*) (s + i));
+    split_mask(fs, s, i, _mm_movemask_epi8(_mm_cmpeq_epi8(b, vsep)));
+  }
+  return split_scalar(fs, s, i, len, sep);
+}
+
+// 32 bytes at a time
+__attribute__((target("avx2")))
+static int split_avx2(struct fields* fs, char* s, size_t len, char sep) {
+  __m256i vsep = _mm256_set1_epi8(sep);
+  size_t i;
+  for(i = 0; i + 32 <= len; i += 32) {
+    __m256i b = _mm256_loadu_si256((__m256i*) (s + i));
+    split_mask(fs, s, i, _mm256_movemask_epi8(_mm256_cmpeq_epi8(b, vsep)));
+  }
+  return split_scalar(fs, s, i, len, sep);
+}
+#endif
+
+static int split_any(struct fields* fs, char* s, size_t len, char sep) {
+  return split_scalar(fs, s, 0, len, sep);
+}
+
+// which splitter to use, picked before main so the -threads workers
+// and streams in other threads only ever read it
+static int (*splitter)(struct fields*, char*, size_t, char) = split_any;
+
+__attribute__((constructor))
+static void split_init() {
+#ifdef SPLIT_X86
+  __builtin_cpu_init();
+  if(getenv("TST_NO_SIMD") != NULL) {
+    // leave it scalar
+  } else if(__builtin_cpu_supports("avx2")) {
+    splitter = split_avx2;
+  } else if(__builtin_cpu_supports("sse2")) {
+    splitter = split_sse2;
+  }
+#endif
+}
+
+// split_fields - split s[0..len-1] at each sep into fs, the
+//   separators are overwritten with '\0' so each field is a
+//   string.  Returns the number of fields which is always >= 1.
+int split_fields(struct fields* fs, char* s, size_t len, char sep) {
+  fs->n = 0;
+  add_field(fs, s);
+  return splitter(fs, s, len, sep);
+}
+
+void free_fields(struct fields* fs) {
+  free(fs->f);
+  fs->f = NULL;
+  fs->n = fs->size = 0;
+}
+
+// the original interface, splitting into a shared struct fields
+char split_sep = ',';
+static struct fields fields;
+
+int split_csv(char *s) {
+  return split_fields(&fields, s, strlen(s), split_sep);
 }
 
 char* field(int n) { 
-  return fields[n];
+  return fields.f[n];
 }
 
 void print_fields() {
   int i;
-  for(i = 0; i != nfields; i++) {
-    printf("#%d = %s\n", i, fields[i]);
+  for(i = 0; i != fields.n; i++) {
+    printf("#%d = %s\n", i, fields.f[i]);
   }
 }
 
@@ -72,6 +165,8 @@ int main() {
     ",f",
     "",
     ",,,,",
+    "0123456789abcdef,0123456789abcdef,0123456789abcdef,0123456789abcdef",
+    "a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,q,r,s,t,u,v,w,x,y,z,0,1,2,3,4,5,6",
     NULL
   };
 
@@ -83,5 +178,29 @@ int main() {
     printf("%d fields\n", nf);
     print_fields();
   }
+
+  // check a very wide line against the scalar splitter
+  struct fields a = { NULL, 0, 0 };
+  size_t len = 100000;
+  char* s = malloc(len + 1);
+  char* t = malloc(len + 1);
+  size_t j;
+  for(j = 0; j < len; j++) {
+    s[j] = (j * 7919) % 13 == 0 ? ',' : 'a' + j % 26;
+  }
+  s[len] = '\0';
+  memcpy(t, s, len + 1);
+  int n = split_fields(&a, s, len, ',');
+  struct fields b = { NULL, 0, 0 };
+  add_field(&b, t);
+  int m = split_scalar(&b, t, 0, len, ',');
+  int ok = n == m;
+  for(i = 0; ok && i < n; i++) {
+    ok = a.f[i] - s == b.f[i] - t;
+  }
+  printf("wide line %d fields %s\n", n, ok ? "ok" : "FAILED");
+  free_fields(&a);
+  free_fields(&b);
+  return !ok;
 }
 #endif
@@ -32,6 +32,21 @@
 #ifndef _TST_SPLIT_H_
 #define _TST_SPLIT_H_
 
+#include <stddef.h>
+
+// a caller owned list of fields which grows as needed, start
+// it off as { NULL, 0, 0 }
+struct fields {
+  char** f; // f[0..n-1] point into the split string
+  int n;
+  int size; // allocated size of f
+};
+
+int split_fields(struct fields* fs, char* s, size_t len, char sep);
+void free_fields(struct fields* fs);
+
+// split into a shared struct fields using split_sep
+extern char split_sep;
 int split_csv(char *s); 
 char* field(int n);
 void print_fields();
@@ -0,0 +1,865 @@
+/*
+ * tst-stream.c - a tst pipeline per struct tst_stream, the
+ *   resampling and filtering tst does without any globals.
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+
+#include "tst-stream.h"
+#include "tst-split.h"
+#include "tst-num.h"
+#include "tst-sd.h"
+
+struct tst_stream {
+  struct tst_opts o;
+  int nv; // values per sample
+  int onv; // values per row written
+  emit_fn emit; // where rows go, NULL for text
+  emit_block_fn emitb; // or blocks of them
+  void* arg;
+
+  tms ot; // the last sample
+  double* ov; // ov[0..nv-1]
+  bool first; // for -every
+  double* cv; // last value that counted as a change
+  bool* cvset; // cv[i] is set
+  struct agg* ag; // -agg state
+  struct sd* sd; // -sd state
+  struct tst_counts n; // what happened to the rows
+
+  // room for tst_block
+  int bsize; // rows
+  unsigned char* keep; // keep[i] row i is still going
+  unsigned char* in; // in[i] row i has a value in vmin..vmax
+  int* idx; // the rows kept so far
+  tms* bt; // and gathered up
+  double* bv;
+  double* gv; // one row from a block
+
+  // csv text
+  bool header; // we've had it
+  bool delta; // delta encoded times
+  tms tsize; // in these units
+  tms old_t; // last time for delta times
+  tms tb; // last time written
+  char** labels; // labels[0..onv-1]
+  struct fields fs;
+  double* rv; // values read from the current line
+  char* line; // the line so far
+  size_t linelen;
+  size_t linesize;
+  char* out; // text for tst_output
+  size_t outlen;
+  size_t outsize;
+  long skipped;
+  char err[256];
+};
+
+void tst_opts_init(struct tst_opts* o) {
+  memset(o, 0, sizeof(*o));
+  o->st = 0;
+  o->et = parse_t("3000-01-01T00:00:00");
+  o->vmin = -INFINITY;
+  o->vmax = INFINITY;
+  o->iunit = 1000;
+  o->isep = ',';
+  o->sep = ",";
+  o->recsep = "\n";
+  o->vfmt = "%g";
+  o->topt = "iso";
+  o->meta_strip = true;
+}
+
+// columns - set up the per column state for nv values
+static bool columns(struct tst_stream* s, int nv) {
+  s->nv = nv;
+  s->onv = s->o.nagg > 0 ? nv * s->o.nagg : nv;
+  s->ov = calloc(nv + 1, sizeof(double));
+  s->rv = calloc(nv + 1, sizeof(double));
+  s->cv = calloc(s->onv + 1, sizeof(double));
+  s->cvset = calloc(s->onv + 1, sizeof(bool));
+  s->labels = calloc(s->onv + 1, sizeof(char*));
+  s->gv = calloc(s->onv + 1, sizeof(double));
+  if(s->ov == NULL || s->rv == NULL || s->cv == NULL || s->cvset == NULL ||
+     s->labels == NULL || s->gv == NULL) {
+    return false;
+  }
+  if(s->o.every > 0 && s->o.nagg > 0) {
+    s->ag = agg_new(nv, s->o.every, s->o.iunit, s->o.nagg, s->o.aggk);
+  }
+  if(s->o.sdev > 0) {
+    s->sd = sd_new(s->onv, s->o.sdev, s->o.sdmax);
+  }
+  return true;
+}
+
+struct tst_stream* tst_open(struct tst_opts* o, int nv) {
+  struct tst_stream* s = calloc(1, sizeof(*s));
+  if(s == NULL) {
+    return NULL;
+  }
+  s->o = *o;
+  s->first = true;
+  s->tsize = 1000;
+  if(nv > 0 && !columns(s, nv)) {
+    tst_close(s);
+    return NULL;
+  }
+  return s;
+}
+
+void tst_close(struct tst_stream* s) {
+  int i;
+  for(i = 0; s->labels != NULL && i < s->onv; i++) {
+    free(s->labels[i]);
+  }
+  free(s->labels);
+  free(s->ov);
+  free(s->rv);
+  free(s->cv);
+  free(s->cvset);
+  free(s->gv);
+  free(s->keep);
+  free(s->in);
+  free(s->idx);
+  free(s->bt);
+  free(s->bv);
+  if(s->ag != NULL) {
+    agg_free(s->ag);
+  }
+  if(s->sd != NULL) {
+    sd_free(s->sd);
+  }
+  free_fields(&s->fs);
+  free(s->line);
+  free(s->out);
+  free(s);
+}
+
+void tst_emit(struct tst_stream* s, emit_fn emit, void* arg) {
+  s->emit = emit;
+  s->arg = arg;
+}
+
+void tst_emit_block(struct tst_stream* s, emit_block_fn emit, void* arg) {
+  s->emitb = emit;
+  s->arg = arg;
+}
+
+int tst_nout(struct tst_stream* s) {
+  return s->onv;
+}
+
+// reserve - room for n more bytes of output
+static char* reserve(struct tst_stream* s, size_t n) {
+  if(s->outlen + n > s->outsize) {
+    size_t size = s->outsize == 0 ? 64 * 1024 : s->outsize;
+    while(s->outlen + n > size) {
+      size *= 2;
+    }
+    char* out = realloc(s->out, size);
+    if(out == NULL) {
+      fprintf(stderr, "tst: fatal out of memory for output\n");
+      exit(13);
+    }
+    s->out = out;
+    s->outsize = size;
+  }
+  return s->out + s->outlen;
+}
+
+static void put(struct tst_stream* s, char* p) {
+  size_t n = strlen(p);
+  memcpy(reserve(s, n), p, n);
+  s->outlen += n;
+}
+
+static void put_printf(struct tst_stream* s, char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(reserve(s, 64), 64, fmt, ap);
+  va_end(ap);
+  if(n >= 64) { // again with enough room
+    va_start(ap, fmt);
+    vsnprintf(reserve(s, n + 1), n + 1, fmt, ap);
+    va_end(ap);
+  }
+  s->outlen += n > 0 ? n : 0;
+}
+
+// rows - a block of rows as lines of text just like tst writes them
+static void rows(struct tst_stream* s, int n, tms* t, double* v) {
+  int tk = strcmp(s->o.topt, "iso") == 0 ? 0 : s->o.topt[0] == '%' ? 1 : 2;
+  int vk = strcmp(s->o.vfmt, "%g") == 0 ? 0 :
+    strcmp(s->o.vfmt, "shortest") == 0 ? 1 : 2;
+  int i, c;
+  for(i = 0; i < n; i++) {
+    if(tk == 0) {
+      s->outlen += fmt_t_buf(t[i], reserve(s, FMT_T_SIZE));
+    } else if(tk == 1) {
+      put(s, fmt_tg(t[i], s->o.topt));
+    } else {
+      put_printf(s, "%ld", (s->delta ? t[i] - s->tb : t[i]) / s->tsize);
+    }
+    s->tb = t[i];
+    for(c = 0; c < s->onv; c++) {
+      double x = v[c * n + i];
+      put(s, s->o.sep);
+      if(vk == 0) {
+	s->outlen += fmt_g(x, reserve(s, FMT_V_SIZE));
+      } else if(vk == 1) {
+	s->outlen += fmt_shortest(x, reserve(s, FMT_V_SIZE));
+      } else {
+	put_printf(s, s->o.vfmt, x);
+      }
+    }
+    put(s, s->o.recsep);
+  }
+}
+
+// out - n rows that made it through
+static void out(struct tst_stream* s, int n, tms* t, double* v) {
+  s->n.out += n;
+  if(s->emitb != NULL) {
+    s->emitb(s->arg, n, t, v);
+  } else if(s->emit != NULL && n == 1) {
+    s->emit(s->arg, t[0], v);
+  } else if(s->emit != NULL) {
+    int i, c;
+    for(i = 0; i < n; i++) {
+      for(c = 0; c < s->onv; c++) {
+	s->gv[c] = v[c * n + i];
+      }
+      s->emit(s->arg, t[i], s->gv);
+    }
+  } else {
+    rows(s, n, t, v);
+  }
+}
+
+static void kept(void* arg, tms t, double* v) {
+  out(arg, 1, &t, v);
+}
+
+// v_inrange - true if any column is in vmin..vmax, always
+//   true without them so NaN and value-less rows get through
+static bool v_inrange(struct tst_stream* s, double* v) {
+  if(s->o.vmin == -INFINITY && s->o.vmax == INFINITY) {
+    return true;
+  }
+  int i;
+  for(i = 0; i < s->onv; i++) {
+    if(s->o.vmin <= v[i] && v[i] <= s->o.vmax) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// v_changed - true if any column has changed by dv or more since
+//   its last change, each column keeps its own reference value so
+//   a wide file behaves just like running each column on its own.
+static bool v_changed(struct tst_stream* s, double* v) {
+  bool changed = false;
+  int i;
+  for(i = 0; i < s->onv; i++) {
+    double x = v[i];
+    if(!s->cvset[i]) { // first
+      s->cvset[i] = true;
+      s->cv[i] = x;
+      changed = true;
+      continue;
+    }
+
+    if(-s->o.zdb < x && x < s->o.zdb) { // treat it 0 since its in zdb
+      x = 0;
+    }
+    double d = x - s->cv[i]; // the change in value
+    if(-s->o.dv < d && d < s->o.dv) { // less than dv so ignore it
+    } else {
+      s->cv[i] = x;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// output1 - a row from the resampling for the filters
+static void output1(void* arg, tms t, double* v) {
+  struct tst_stream* s = arg;
+  s->n.rows++;
+  if(s->o.st <= t && t <= s->o.et) {
+    if(!v_inrange(s, v)) {
+      s->n.vrange++;
+    } else if(s->sd != NULL) { // the door decides, a row late
+      sd_add(s->sd, t, v, kept, s);
+    } else if(v_changed(s, v)) {
+      kept(s, t, v);
+    } else {
+      s->n.unchanged++;
+    }
+  } else { // outside the st..et range
+    s->n.trange++;
+  }
+}
+
+static tms next_every(tms t, tms every) {
+  return ((t / every) + 1) * every;
+}
+
+// every - collect samples until the last one before
+//   a value that rounds
+static void every(struct tst_stream* s, tms t, double* v) {
+  if(s->first) {
+    if((t % s->o.every) == 0) {
+      output1(s, t, v);
+    }
+    s->first = false;
+  } else {
+    while((s->ot = next_every(s->ot, s->o.every)) < t) {
+      output1(s, s->ot, s->ov);
+    }
+    if(s->ot == t) {
+      output1(s, t, v);
+    }
+  }
+}
+
+void tst_sample(struct tst_stream* s, tms t, double* v) {
+  s->n.samples++;
+  if(s->o.every <= 0) { // not resampling the data
+    output1(s, t, v); // so send it straight off
+  } else if(s->ag != NULL) {
+    agg_add(s->ag, t, v, output1, s);
+  } else {
+    every(s, t, v);
+  }
+  s->ot = t;
+  memcpy(s->ov, v, s->nv * sizeof(double));
+}
+
+// scratch - room for blocks of n rows
+static bool scratch(struct tst_stream* s, int n) {
+  if(n <= s->bsize) {
+    return true;
+  }
+  free(s->keep);
+  free(s->in);
+  free(s->idx);
+  free(s->bt);
+  free(s->bv);
+  s->keep = malloc(n);
+  s->in = malloc(n);
+  s->idx = malloc(n * sizeof(int));
+  s->bt = malloc(n * sizeof(tms));
+  s->bv = malloc((size_t) n * s->onv * sizeof(double));
+  s->bsize = n;
+  if(s->keep == NULL || s->in == NULL || s->idx == NULL || s->bt == NULL ||
+     s->bv == NULL) {
+    s->bsize = 0;
+    return false;
+  }
+  return true;
+}
+
+// changed - v_changed for column x of the m rows idx[0..m-1], ch[j]
+//   is set if row idx[j] changed this column
+static void changed(struct tst_stream* s, int c, double* x, int* idx, int m,
+		    unsigned char* ch) {
+  double zdb = s->o.zdb, dv = s->o.dv;
+  double cv = s->cv[c];
+  int j = 0;
+  if(m > 0 && !s->cvset[c]) { // first, as it is
+    s->cvset[c] = true;
+    cv = x[idx[0]];
+    ch[0] = 1;
+    j = 1;
+  }
+  if(dv <= 0) { // everything is a change so only the last one counts
+    if(j < m) {
+      cv = x[idx[m - 1]];
+      cv = -zdb < cv && cv < zdb ? 0 : cv;
+    }
+    for(; j < m; j++) {
+      ch[j] = 1;
+    }
+  } else {
+    for(; j < m; j++) {
+      double y = x[idx[j]];
+      if(-zdb < y && y < zdb) {
+	y = 0;
+      }
+      double d = y - cv;
+      if(!(-dv < d && d < dv)) {
+	cv = y;
+	ch[j] = 1;
+      }
+    }
+  }
+  s->cv[c] = cv;
+}
+
+void tst_block(struct tst_stream* s, int n, tms* t, double* v) {
+  int i, j, c, m;
+  if(n <= 0) {
+    return;
+  }
+  if(s->o.every > 0 || !scratch(s, n)) { // one at a time
+    for(i = 0; i < n; i++) {
+      for(c = 0; c < s->nv; c++) {
+	s->gv[c] = v[c * n + i];
+      }
+      tst_sample(s, t[i], s->gv);
+    }
+    return;
+  }
+  s->n.samples += n;
+  s->n.rows += n;
+
+  // -st/-et
+  unsigned char* keep = s->keep;
+  tms st = s->o.st, et = s->o.et;
+  for(i = 0, m = 0; i < n; i++) {
+    keep[i] = (st <= t[i]) & (t[i] <= et);
+    m += keep[i];
+  }
+  s->n.trange += n - m;
+
+  // -vmin/-vmax, a row needs a value in range in any column
+  if(m > 0 && (s->o.vmin != -INFINITY || s->o.vmax != INFINITY)) {
+    double lo = s->o.vmin, hi = s->o.vmax;
+    unsigned char* in = s->in;
+    memset(in, 0, n);
+    for(c = 0; c < s->nv; c++) {
+      double* x = v + (size_t) c * n;
+      for(i = 0; i < n; i++) {
+	in[i] |= (lo <= x[i]) & (x[i] <= hi);
+      }
+    }
+    for(i = 0, m = 0; i < n; i++) {
+      s->n.vrange += keep[i] & !in[i];
+      keep[i] &= in[i];
+      m += keep[i];
+    }
+  }
+
+  // the rows left, without a branch per row
+  int* idx = s->idx;
+  for(i = 0, m = 0; i < n; i++) {
+    idx[m] = i;
+    m += keep[i];
+  }
+
+  if(s->sd != NULL) { // the door decides, a row at a time
+    for(j = 0; j < m; j++) {
+      for(c = 0; c < s->nv; c++) {
+	s->gv[c] = v[(size_t) c * n + idx[j]];
+      }
+      sd_add(s->sd, t[idx[j]], s->gv, kept, s);
+    }
+  } else if(m > 0) { // -dv/-zdb a column at a time
+    unsigned char* ch = s->in;
+    memset(ch, 0, m);
+    for(c = 0; c < s->nv; c++) {
+      changed(s, c, v + (size_t) c * n, idx, m, ch);
+    }
+    int k;
+    for(j = 0, k = 0; j < m; j++) {
+      idx[k] = idx[j];
+      k += ch[j];
+    }
+    s->n.unchanged += m - k;
+    if(k == n) { // all of them
+      out(s, n, t, v);
+    } else if(k > 0) {
+      for(j = 0; j < k; j++) {
+	s->bt[j] = t[idx[j]];
+      }
+      for(c = 0; c < s->nv; c++) {
+	double* x = v + (size_t) c * n;
+	double* y = s->bv + (size_t) c * k;
+	for(j = 0; j < k; j++) {
+	  y[j] = x[idx[j]];
+	}
+      }
+      out(s, k, s->bt, s->bv);
+    }
+  }
+
+  s->ot = t[n - 1];
+  for(c = 0; c < s->nv; c++) {
+    s->ov[c] = v[(size_t) c * n + n - 1];
+  }
+}
+
+static int fail(struct tst_stream* s, char* fmt, char* what) {
+  snprintf(s->err, sizeof(s->err), fmt, what);
+  return -1;
+}
+
+// header - the t,v1,v2... line
+static int header(struct tst_stream* s, char* line, size_t len) {
+  int n = split_fields(&s->fs, line, len, s->o.isep);
+  if(n < 2) {
+    return fail(s, "must have at least two fields in header: %s", line);
+  }
+  if(!parse_t_header(s->fs.f[0], &s->delta, &s->tsize)) {
+    return fail(s, "failed to parse tlabel %s", s->fs.f[0]);
+  }
+  if(s->nv == 0 && !columns(s, n - 1)) {
+    return fail(s, "out of memory for %s", "columns");
+  } else if(n - 1 != s->nv) {
+    return fail(s, "header has the wrong number of values: %s", line);
+  }
+  int i, nk = s->o.nagg > 0 ? s->o.nagg : 1;
+  for(i = 0; i < s->onv; i++) { // label_mean, label_max ...
+    char* l = s->fs.f[1 + i / nk];
+    char* a = s->o.nagg > 0 ? agg_name(s->o.aggk[i % nk]) : NULL;
+    free(s->labels[i]);
+    if((s->labels[i] = malloc(strlen(l) + (a ? strlen(a) : 0) + 2)) == NULL) {
+      return fail(s, "out of memory for %s", "labels");
+    }
+    if(a != NULL) {
+      sprintf(s->labels[i], "%s_%s", l, a);
+    } else {
+      strcpy(s->labels[i], l);
+    }
+  }
+  s->header = true;
+  if(s->emit == NULL) {
+    put(s, unparse_t_header(s->delta, s->tsize));
+    for(i = 0; i < s->onv; i++) {
+      put(s, s->o.sep);
+      put(s, s->labels[i]);
+    }
+    put(s, "\n");
+  }
+  return 0;
+}
+
+// line - a whole line of csv text
+static int line(struct tst_stream* s, char* line, size_t len) {
+  if((s->o.meta_strip && line[0] == '#') || len == 0) {
+    return 0;
+  }
+  if(!s->header) {
+    return header(s, line, len);
+  }
+  if(split_fields(&s->fs, line, len, s->o.isep) != s->nv + 1) {
+    return fail(s, "wrong number of fields at %s", s->fs.f[0]);
+  }
+  tms t = parse_t_len(s->fs.f[0], s->fs.f[1] - s->fs.f[0] - 1);
+  if(!ISTIME(t)) {
+    s->skipped++;
+    return 0;
+  }
+  if(parse_t_numeric()) { // in header units not ms
+    t *= s->tsize;
+  }
+  int i;
+  for(i = 0; i < s->nv; i++) {
+    if(!parse_v(s->fs.f[i + 1], &s->rv[i])) {
+      s->skipped++;
+      return 0;
+    }
+  }
+  if(s->delta) {
+    t = t + s->old_t;
+    s->old_t = t;
+  }
+  tst_sample(s, t, s->rv);
+  return 0;
+}
+
+// more - room for n more bytes (and a '\0') of the current line
+static bool more(struct tst_stream* s, size_t n) {
+  if(s->linelen + n + 1 > s->linesize) {
+    size_t size = s->linesize == 0 ? 256 : s->linesize;
+    while(s->linelen + n + 1 > size) {
+      size *= 2;
+    }
+    char* p = realloc(s->line, size);
+    if(p == NULL) {
+      return false;
+    }
+    s->line = p;
+    s->linesize = size;
+  }
+  return true;
+}
+
+int tst_feed(struct tst_stream* s, char* p, size_t n) {
+  while(n > 0) {
+    char* nl = memchr(p, '\n', n);
+    size_t k = nl != NULL ? (size_t) (nl - p) : n;
+    if(!more(s, k)) {
+      return fail(s, "out of memory for %s", "a line");
+    }
+    memcpy(s->line + s->linelen, p, k);
+    s->linelen += k;
+    if(nl == NULL) { // the rest comes later
+      break;
+    }
+    p += k + 1;
+    n -= k + 1;
+    s->line[s->linelen] = '\0';
+    size_t len = s->linelen;
+    s->linelen = 0;
+    if(line(s, s->line, len) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int tst_end(struct tst_stream* s) {
+  if(s->linelen > 0) { // without a '\n'
+    s->line[s->linelen] = '\0';
+    size_t len = s->linelen;
+    s->linelen = 0;
+    if(line(s, s->line, len) < 0) {
+      return -1;
+    }
+  }
+  if(s->ag != NULL) { // the last bucket
+    agg_end(s->ag, output1, s);
+  }
+  if(s->sd != NULL) { // and the row the door was holding
+    sd_end(s->sd, kept, s);
+  }
+  return 0;
+}
+
+char* tst_output(struct tst_stream* s, size_t* n) {
+  *n = s->outlen;
+  s->outlen = 0;
+  return s->out;
+}
+
+char* tst_error(struct tst_stream* s) {
+  return s->err;
+}
+
+long tst_skipped(struct tst_stream* s) {
+  return s->skipped;
+}
+
+struct tst_counts* tst_counts(struct tst_stream* s) {
+  return &s->n;
+}
+
+void tst_save(struct tst_stream* s, FILE* fp) {
+  fprintf(fp, "stream %d %d %ld %d %ld %ld\n", s->nv, s->onv,
+	  s->ot, s->first, s->old_t, s->tb);
+  int i;
+  for(i = 0; i < s->nv; i++) {
+    fprintf(fp, "%a\n", s->ov[i]);
+  }
+  for(i = 0; i < s->onv; i++) {
+    fprintf(fp, "%a %d\n", s->cv[i], s->cvset[i]);
+  }
+  if(s->ag != NULL) {
+    agg_save(s->ag, fp);
+  }
+  if(s->sd != NULL) {
+    sd_save(s->sd, fp);
+  }
+}
+
+bool tst_load(struct tst_stream* s, FILE* fp) {
+  int nv, onv, first, set;
+  if(fscanf(fp, " stream %d %d %ld %d %ld %ld", &nv, &onv,
+	    &s->ot, &first, &s->old_t, &s->tb) != 6 ||
+     nv != s->nv || onv != s->onv) {
+    return false;
+  }
+  s->first = first;
+  int i;
+  for(i = 0; i < s->nv; i++) {
+    if(fscanf(fp, "%la", &s->ov[i]) != 1) {
+      return false;
+    }
+  }
+  for(i = 0; i < s->onv; i++) {
+    if(fscanf(fp, "%la %d", &s->cv[i], &set) != 2) {
+      return false;
+    }
+    s->cvset[i] = set;
+  }
+  return (s->ag == NULL || agg_load(s->ag, fp)) &&
+    (s->sd == NULL || sd_load(s->sd, fp));
+}
+
+#ifdef TEST
+#include <pthread.h>
+
+static char text[64 * 1024];
+static struct tst_opts opts;
+
+struct run {
+  int step; // bytes per tst_feed
+  char out[64 * 1024];
+  size_t n;
+};
+
+// run - text through a stream of its own a few bytes at a time
+static void* run(void* arg) {
+  struct run* r = arg;
+  struct tst_stream* s = tst_open(&opts, 0);
+  size_t i, len = strlen(text);
+  for(i = 0; i < len; i += r->step) {
+    size_t k = len - i < (size_t) r->step ? len - i : (size_t) r->step;
+    if(tst_feed(s, text + i, k) < 0) {
+      printf("feed: %s\n", tst_error(s));
+      exit(1);
+    }
+    size_t n;
+    char* p = tst_output(s, &n);
+    memcpy(r->out + r->n, p, n);
+    r->n += n;
+  }
+  tst_end(s);
+  size_t n;
+  char* p = tst_output(s, &n);
+  memcpy(r->out + r->n, p, n);
+  r->n += n;
+  tst_close(s);
+  return NULL;
+}
+
+// saved - what tst_save writes for s
+static char* saved(struct tst_stream* s) {
+  char* p;
+  size_t n;
+  FILE* fp = open_memstream(&p, &n);
+  tst_save(s, fp);
+  fclose(fp);
+  return p;
+}
+
+// blocks - the text and state from n samples a row at a time and in
+//   blocks of each size up to 40 with o, the number of sizes that
+//   differ
+static int blocks(struct tst_opts* o, int n) {
+  static tms t[1000];
+  static double v[2000], b[80];
+  int i, k, bad = 0;
+  for(i = 0; i < n; i++) {
+    t[i] = 981000000000L + i * 700L;
+    v[2*i] = i % 17;
+    v[2*i + 1] = i % 5 == 0 ? NAN : i * 0.5;
+  }
+  struct tst_stream* s = tst_open(o, 2);
+  for(i = 0; i < n; i++) {
+    tst_sample(s, t[i], &v[2*i]);
+  }
+  char* state = saved(s);
+  tst_end(s);
+  size_t len;
+  char* p = tst_output(s, &len);
+  char* want = malloc(len);
+  memcpy(want, p, len);
+  tst_close(s);
+  for(k = 1; k <= 40; k++) {
+    s = tst_open(o, 2);
+    for(i = 0; i < n; i += k) {
+      int m = n - i < k ? n - i : k, j;
+      for(j = 0; j < m; j++) { // column by column
+	b[j] = v[2*(i + j)];
+	b[m + j] = v[2*(i + j) + 1];
+      }
+      tst_block(s, m, &t[i], b);
+    }
+    char* st = saved(s);
+    bad += strcmp(st, state) != 0;
+    free(st);
+    tst_end(s);
+    size_t got;
+    p = tst_output(s, &got);
+    bad += got != len || memcmp(p, want, len) != 0;
+    tst_close(s);
+  }
+  free(want);
+  free(state);
+  return bad;
+}
+
+int main() {
+  int i, n = 0;
+  n += sprintf(text + n, "# made up\nt,a,b\n");
+  for(i = 0; i < 1000; i++) {
+    n += sprintf(text + n, "%s,%d,%g\n", fmt_t(981000000000L + i * 700L),
+		 i % 17, i * 0.5);
+  }
+  tst_opts_init(&opts);
+  opts.every = 10000;
+  opts.nagg = agg_parse("mean,max", opts.aggk);
+
+  // the same text in different sized pieces on eight threads at once
+  struct run rs[8];
+  pthread_t tids[8];
+  memset(rs, 0, sizeof(rs));
+  for(i = 0; i < 8; i++) {
+    rs[i].step = i == 0 ? (int) strlen(text) : i * 7 + 1;
+    pthread_create(&tids[i], NULL, run, &rs[i]);
+  }
+  int bad = 0;
+  for(i = 0; i < 8; i++) {
+    pthread_join(tids[i], NULL);
+    bad += rs[i].n != rs[0].n || memcmp(rs[i].out, rs[0].out, rs[0].n) != 0;
+  }
+  fwrite(rs[0].out, 1, 200, stdout);
+  printf("...\n%zu bytes, %d streams differ\n", rs[0].n, bad);
+
+  // blocks go the same way as samples whatever the options
+  struct tst_opts o;
+  int nb = 0;
+  for(i = 0; i < 7; i++) {
+    tst_opts_init(&o);
+    o.st = 981000000000L + 20000;
+    o.et = 981000000000L + 600000;
+    switch(i) {
+    case 1: o.dv = 3; break;
+    case 2: o.dv = 2; o.zdb = 4; o.vmin = 3; break;
+    case 3: o.vmin = 5; o.vmax = 10; o.zdb = 6; break;
+    case 4: o.sdev = 1.5; o.sdmax = 30000; break;
+    case 5: o.every = 5000; o.dv = 1; break;
+    case 6: o.st = 0; o.zdb = 8; break;
+    }
+    nb += blocks(&o, 1000);
+  }
+  printf("%d block sizes differ\n", nb);
+  return bad != 0 || nb != 0;
+}
+#endif
@@ -0,0 +1,127 @@
+/*
+ * tst-stream.h - the tst pipeline as a library, libtst.a
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TST_STREAM_H_
+#define _TST_STREAM_H_ 1
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "tst-t.h"
+#include "tst-agg.h"
+
+// A struct tst_stream holds everything one series needs on its way
+// through tst: -every resampling or -agg, -st/-et, -vmin/-vmax and
+// -dv/-zdb or -sd.  Nothing is shared between streams so any number
+// of them can run at once, each on one thread at a time (or many on
+// one thread).  Samples are pushed in with tst_sample (or a block
+// at a time with tst_block) and the rows that survive come out
+// through the emit function, or the bytes of a csv file (header
+// first) go in with tst_feed and come out as csv text from
+// tst_output.
+//
+// Blocks are held column by column, t[0..n-1] and value c of row i
+// in v[c * n + i], so a row on its own (n = 1) is just v[0..].
+// Without -every or -agg a block goes through each stage in one
+// loop per stage: the -st/-et and -vmin/-vmax masks, -dv/-zdb one
+// column at a time and then the rows that are left are gathered up
+// and emitted together.
+
+// where a block of rows goes
+typedef void (*emit_block_fn)(void* arg, int n, tms* t, double* v);
+
+// the command line options that shape the output
+struct tst_opts {
+  tms st, et; // only rows in st..et
+  double vmin, vmax; // with a value in vmin..vmax
+  double dv, zdb; // that changed by dv, values inside zdb are 0
+  double sdev; // swinging door deviation instead of dv if > 0
+  tms sdmax; // and the longest gap it leaves, 0 for none
+  tms every; // resample every ms if > 0
+  int nagg; // aggregates for each every bucket, 0 to sample and hold
+  int aggk[AGG_N]; // aggk[0..nagg-1], see agg_parse
+  tms iunit; // time unit for integral
+  // csv text for tst_feed/tst_output
+  char isep; // input field separator
+  char* sep; // output field separator
+  char* recsep; // record separator
+  char* vfmt; // printf format for values, %g or shortest are fastest
+  char* topt; // iso, %Y... for strftime or the header's time units
+  bool meta_strip; // skip # lines
+};
+
+void tst_opts_init(struct tst_opts* o); // the command line defaults
+
+struct tst_stream;
+
+// tst_open - a stream of nv values per sample, nv is 0 if they come
+//   from the header of the csv text given to tst_feed.  NULL if out
+//   of memory, o is copied but its strings must last as long as s.
+struct tst_stream* tst_open(struct tst_opts* o, int nv);
+void tst_close(struct tst_stream* s);
+
+// rows go to emit(arg, t, v[0..tst_nout(s)-1]) rather than tst_output
+void tst_emit(struct tst_stream* s, emit_fn emit, void* arg);
+int tst_nout(struct tst_stream* s); // values per row, nv * nagg with -agg
+// or to emit a block at a time
+void tst_emit_block(struct tst_stream* s, emit_block_fn emit, void* arg);
+
+// push a sample, t in ms in time order and v[0..nv-1]
+void tst_sample(struct tst_stream* s, tms t, double* v);
+// push n samples, the same as tst_sample for each row of the block
+void tst_block(struct tst_stream* s, int n, tms* t, double* v);
+// push the next n bytes of csv text, lines can be split anywhere,
+// -1 on a bad header or row with tst_error saying why
+int tst_feed(struct tst_stream* s, char* p, size_t n);
+// the input is done so flush out the last -agg bucket or -sd row
+int tst_end(struct tst_stream* s);
+char* tst_output(struct tst_stream* s, size_t* n); // new text, valid
+						   // until the next call
+char* tst_error(struct tst_stream* s);
+long tst_skipped(struct tst_stream* s); // bad times or values ignored
+
+// what happened to the samples pushed in so far
+struct tst_counts {
+  long samples; // pushed in
+  long rows; // after -every or -agg
+  long trange; // of those outside st..et
+  long vrange; // with no value in vmin..vmax
+  long unchanged; // dropped by dv
+  long out; // written, the rest were dropped by -sd
+};
+struct tst_counts* tst_counts(struct tst_stream* s);
+
+// the state between samples as text, see agg_save
+void tst_save(struct tst_stream* s, FILE* fp);
+bool tst_load(struct tst_stream* s, FILE* fp);
+
+#endif /* _TST_STREAM_H_ */
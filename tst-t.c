@@ -41,14 +41,19 @@
 #define _ISOC99_SOURCE
 #include <math.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include "tst-t.h"
+#include "tst-tz.h"
 
 static int verbose = 0;
 
 // currently cached fmt to use (-1 is invalid, so we do a lookup
-// on startup
-int cfmt = -1; 
+// on startup, its per thread so parsers can run in parallel
+__thread int cfmt = -1; 
+
+__thread struct parse_t_counts parse_t_counts;
 
 // the actual timestamp formats
 char* fmts[100][8] = {
@@ -64,38 +69,322 @@ char* fmts[100][8] = {
   { NULL }
 };
 
+// each fmts[i] compiled by tf_compile, NULL if it needs strptime
+static struct tf_op* ctfs[100];
+static pthread_once_t ctfs_once = PTHREAD_ONCE_INIT;
+static int tf_first; // where the search through fmts starts
+
+static struct tf_op* tf_compile(char* fmt[]);
+static tms tf_run(struct tf_op* op, char* s);
+
+static void tf_compile_all() {
+  int i;
+  for(i = 0; fmts[i][0] != NULL; i++) {
+    ctfs[i] = tf_compile(fmts[i]);
+  }
+}
+
+// try_fmt - s in fmts[i], compiled if we can
+static tms try_fmt(char* s, int i) {
+  pthread_once(&ctfs_once, tf_compile_all);
+  return ctfs[i] != NULL ? tf_run(ctfs[i], s) : parse_tf(s, fmts[i]);
+}
+
+// parse_t_format - add a strptime format which is tried before
+//   the built in ones, call it before anything is parsed
+bool parse_t_format(char* fmt) {
+  pthread_once(&ctfs_once, tf_compile_all);
+  int i;
+  for(i = 0; fmts[i][0] != NULL; i++) {
+  }
+  if(i + 1 >= (int) (sizeof(fmts) / sizeof(fmts[0]))) {
+    return false;
+  }
+  fmts[i][0] = fmt;
+  fmts[i][1] = NULL;
+  ctfs[i] = tf_compile(fmts[i]);
+  tf_first = i;
+  return true;
+}
+
+// the format lock: once parse_t_lock rows in a row have matched the
+// same format only that one is tried until parse_t_reset
+int parse_t_lock;
+static __thread int tseen; // rows in a row that matched cfmt
+static __thread bool tlocked;
+
+void parse_t_reset() {
+  cfmt = -1;
+  tseen = 0;
+  tlocked = false;
+}
+
+// matched - s was in fmts[f]
+static void matched(int f) {
+  tseen = f == cfmt ? tseen + 1 : 1;
+  cfmt = f;
+  if(parse_t_lock > 0 && tseen >= parse_t_lock) {
+    tlocked = true;
+  }
+}
+
 // parse timestamp s against all the formats in fmts[]
-// using parse_tf
+// ISO8601 timestamps in the fmts[1..3] layouts are handled by
+// parse_iso first, then the last format that worked and then the
+// rest (starting with any -tfmt), compiled or with parse_tf.
 tms parse_t(char* s) {
   if(verbose) {
     printf("* parse_t '%s'\n", s);
   }
+
+  int f;
+  if(tlocked) { // only the format we've settled on
+    tms t = 1 <= cfmt && cfmt <= 3 ? parse_iso(s, &f) : NOTIME;
+    if(!ISTIME(t)) {
+      t = try_fmt(s, cfmt);
+    }
+    if(ISTIME(t)) {
+      parse_t_counts.hit++;
+    } else {
+      parse_t_counts.bad++;
+    }
+    return t;
+  }
+
+  tms ti = parse_iso(s, &f);
+  if(ISTIME(ti)) {
+    matched(f);
+    parse_t_counts.iso++;
+    return ti;
+  }
   
   if(cfmt != -1) { // try the cached fmt first
-    tms t = parse_tf(s, fmts[cfmt]);
+    tms t = try_fmt(s, cfmt);
     if(ISTIME(t)) {
+      matched(cfmt);
+      parse_t_counts.hit++;
       return t;
     } 
   }
+  parse_t_counts.miss++;
     
-  int i;
-  for(i = 0; fmts[i][0] != NULL; i++) {
+  int n, k;
+  for(n = 0; fmts[n][0] != NULL; n++) {
+  }
+  for(k = 0; k < n; k++) {
+    int i = (tf_first + k) % n;
     if(verbose) {
       printf("** parse_t trying fmts[%d]\n", i);
     }
-    tms t = parse_tf(s, fmts[i]);
+    parse_t_counts.fallback++;
+    tms t = try_fmt(s, i);
     if(ISTIME(t)) {
-      cfmt = i;
+      matched(i);
       return t;
     }
   }  
   if(verbose) { 
     printf("** parse_t all formats failed\n");
   }
-  cfmt = -1;
+  parse_t_counts.bad++;
+  // cfmt is left alone so one odd line doesn't cost the next
+  // one a search
   return NOTIME;
 }
 
+#define DIGIT(c) ((unsigned) ((c) - '0') <= 9)
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ONES 0x0101010101010101ULL // a byte of 1s
+
+// eight - the 8 digits at p (the first is the most significant,
+//   skip of them are taken as 0) in three multiplies, -1 if they
+//   aren't all digits
+static inline long eight(char* p, int skip) {
+  uint64_t x;
+  memcpy(&x, p, 8);
+  if(((x & (0xF0 * ONES)) | (((x + 6 * ONES) & (0xF0 * ONES)) >> 4)) !=
+     0x33 * ONES) {
+    return -1;
+  }
+  x = (x - '0' * ONES) & (~0ULL << (8 * skip)); // the first skip are 0
+  x = (x * 10 + (x >> 8)) & (0xFF * 0x0001000100010001ULL);
+  x = (x * 100 + (x >> 16)) & (0xFFFF * 0x0000000100000001ULL);
+  return (x * 10000 + (x >> 32)) & 0xFFFFFFFF;
+}
+#endif
+
+// parse_digits - [+-]digits in s[0..len-1] 8 at a time, NOTIME if
+//   it's anything else (spaces ...) or might not fit in a tms
+static tms parse_digits(char* s, size_t len) {
+  bool neg = len > 0 && s[0] == '-';
+  if(len > 0 && (s[0] == '-' || s[0] == '+')) {
+    s++;
+    len--;
+  }
+  if(len == 0 || len > 18) {
+    return NOTIME;
+  }
+  long t = 0;
+  size_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if(len >= 8) {
+    for(; i + 8 <= len; i += 8) {
+      long d = eight(s + i, 0);
+      if(d < 0) {
+	return NOTIME;
+      }
+      t = t * 100000000 + d;
+    }
+    if(i < len) { // the last 8 again keeping the ones we haven't used
+      long d = eight(s + len - 8, 8 - (len - i));
+      if(d < 0) {
+	return NOTIME;
+      }
+      static const long p10[] = { 1, 10, 100, 1000, 10000, 100000,
+				  1000000, 10000000 };
+      t = t * p10[len - i] + d;
+    }
+    return neg ? -t : t;
+  }
+#endif
+  for(; i < len; i++) {
+    if(!DIGIT(s[i])) {
+      return NOTIME;
+    }
+    t = t * 10 + (s[i] - '0');
+  }
+  return neg ? -t : t;
+}
+
+// parse_t_len - parse_t for s[0..len-1] (which is also terminated),
+//   numeric times are read 8 digits at a time by parse_digits when
+//   parse_t would take them as numeric too (so not with a -tfmt or
+//   when locked to another format)
+tms parse_t_len(char* s, size_t len) {
+  if(cfmt <= 0 && tf_first == 0 && !(tlocked && cfmt != 0)) {
+    tms t = parse_digits(s, len);
+    if(ISTIME(t)) {
+      if(cfmt == 0) {
+	parse_t_counts.hit++;
+      } else {
+	parse_t_counts.miss++;
+	parse_t_counts.fallback++;
+      }
+      matched(0);
+      return t;
+    }
+  }
+  return parse_t(s);
+}
+
+// true if the last timestamp parse_t matched was numeric, i.e.
+// it is in units of the header tsize rather than ms.
+bool parse_t_numeric() {
+  return cfmt == 0;
+}
+
+// days_from_civil - days since 1970-01-01 of y-m-d in the
+//   proleptic Gregorian calendar, m is 1..12 and d may run
+//   past the end of the month just like mktime.
+long days_from_civil(long y, int m, int d) {
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400; // [0, 399]
+  long doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy; // [0, 146096]
+  return era * 146097 + doe - 719468;
+}
+
+#define D2(p) (((p)[0] - '0') * 10 + ((p)[1] - '0'))
+
+// parse_iso - parse the fixed ISO8601 layout
+//   YYYY-MM-DDTHH:MM:SS[.f...][Z|+hh[[:]mm]|-hh[[:]mm]]
+// checking each position by hand and without any libc calls.
+// Returns NOTIME if s isn't in that layout (so the caller can
+// fall back to parse_tf), otherwise the time with *fmt set to
+// the fmts[] entry it corresponds to.  Times without a zone
+// are in the -tz zone, UTC unless it's been loaded.
+tms parse_iso(char* s, int* fmt) {
+  char* p = s;
+  while(*p == ' ' || *p == '\t') {
+    p++;
+  }
+  if(!(DIGIT(p[0]) && DIGIT(p[1]) && DIGIT(p[2]) && DIGIT(p[3]) &&
+       p[4] == '-' && DIGIT(p[5]) && DIGIT(p[6]) &&
+       p[7] == '-' && DIGIT(p[8]) && DIGIT(p[9]) &&
+       p[10] == 'T' && DIGIT(p[11]) && DIGIT(p[12]) &&
+       p[13] == ':' && DIGIT(p[14]) && DIGIT(p[15]) &&
+       p[16] == ':' && DIGIT(p[17]) && DIGIT(p[18]))) {
+    return NOTIME;
+  }
+  long y = D2(p) * 100 + D2(p + 2);
+  int mon = D2(p + 5);
+  int d = D2(p + 8);
+  int h = D2(p + 11);
+  int min = D2(p + 14);
+  int sec = D2(p + 17);
+  if(mon < 1 || mon > 12 || d < 1 || d > 31 ||
+     h > 23 || min > 59 || sec > 60) {
+    return NOTIME;
+  }
+  p += 19;
+  *fmt = 1;
+
+  tms ms = 0;
+  if(*p == '.') { // subseconds, keep the first 3 digits exactly
+    p++;
+    if(!DIGIT(*p)) {
+      return NOTIME;
+    }
+    int n;
+    for(n = 0; DIGIT(*p); n++, p++) {
+      if(n < 3) {
+	ms = ms * 10 + (*p - '0');
+      }
+    }
+    for(; n < 3; n++) {
+      ms *= 10;
+    }
+    *fmt = 2;
+  }
+
+  long off = 0; // zone offset in minutes
+  if(*p == 'Z') {
+    p++;
+    *fmt = 3;
+  } else if(*p == '+' || *p == '-') {
+    int sign = *p++ == '-' ? -1 : 1;
+    if(!(DIGIT(p[0]) && DIGIT(p[1]))) {
+      return NOTIME;
+    }
+    off = D2(p) * 60;
+    p += 2;
+    if(*p == ':') {
+      p++;
+    }
+    if(DIGIT(p[0]) && DIGIT(p[1])) {
+      off += D2(p);
+      p += 2;
+    }
+    off *= sign;
+    *fmt = 3;
+  }
+  while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+    p++;
+  }
+  if(*p != '\0') {
+    return NOTIME;
+  }
+
+  long secs = days_from_civil(y, mon, d) * 86400L +
+    h * 3600L + (min - off) * 60L + sec;
+  if(*fmt != 3) {
+    secs = tz_to_utc(secs);
+  }
+  return secs * 1000 + ms;
+}
+
 // parse timestamp s against fmt[0..] and return either
 // the time as a tms or NOTIME
 tms parse_tf(char* s, char* fmt[]) {
@@ -108,6 +397,7 @@ tms parse_tf(char* s, char* fmt[]) {
 
   char *ss = s;
   struct tm tmb;
+  bool zoned = false; // %z so not in the -tz zone
 
   memset(&tmb, 0, sizeof(tmb));
   init_subsec();
@@ -131,6 +421,7 @@ tms parse_tf(char* s, char* fmt[]) {
 	}
       }
     } else { // strptime format
+      zoned = zoned || strstr(fmt[i], "%z") != NULL;
       char* r = strptime(ss, fmt[i], &tmb);
       if(r == NULL) { 
 	return NOTIME;
@@ -144,12 +435,248 @@ tms parse_tf(char* s, char* fmt[]) {
   if(*ss != '\0') { 
     return NOTIME;
   } else {
-    tms tb = (1000 * 
-	      ((long)mktime(&tmb))) + get_subsec();
+    // like parse_iso adjusted by any %z offset or from -tz, this
+    // is timegm without the lock it takes in glibc
+    long secs = days_from_civil(1900L + tmb.tm_year, tmb.tm_mon + 1,
+				tmb.tm_mday) * 86400L +
+      tmb.tm_hour * 3600L + tmb.tm_min * 60L + tmb.tm_sec;
+    secs = zoned ? secs - tmb.tm_gmtoff : tz_to_utc(secs);
+    tms tb = (1000 * secs) + get_subsec();
     return tb;
   }
 }
 
+// Formats are compiled to a list of ops which do what glibc's
+// strptime does for the same format in the C locale without going
+// through the locale for every field: numbers skip leading spaces
+// and take up to width digits while they stay in range, spaces in
+// the format match any run of spaces, %p is only used with %I and
+// the fields start off zero (so "%Y" alone is the day before the
+// 1st of January like timegm makes it).  Anything else (names of
+// months or days, %j, %U ...) isn't compiled and uses strptime.
+
+enum { TF_END, TF_SPACE, TF_LIT, TF_NUM, TF_AMPM, TF_ZONE, TF_FRAC,
+       TF_NUMERIC };
+enum { F_YEAR, F_YEAR2, F_MON, F_DAY, F_HOUR, F_HOUR12, F_MIN, F_SEC,
+       F_N };
+
+struct tf_op {
+  unsigned char op;
+  unsigned char field; // TF_NUM: which one
+  unsigned char width; // and how many digits at most
+  char lit; // TF_LIT: the character
+  int lo, hi; // TF_NUM: its range
+};
+
+#define TF_OPS 64 // ops in a compiled format
+
+tms parse_numeric_ts(char*);
+
+static bool tf_add(struct tf_op* ops, int* n, int op, int field, int width,
+		   int lo, int hi, char lit) {
+  if(*n >= TF_OPS - 1) {
+    return false;
+  }
+  struct tf_op o = { op, field, width, lit, lo, hi };
+  ops[(*n)++] = o;
+  return true;
+}
+
+// tf_piece - compile one strptime format onto ops[*n...]
+static bool tf_piece(char* f, struct tf_op* ops, int* n) {
+  while(*f != '\0') {
+    bool ok;
+    if(isspace((unsigned char) *f)) {
+      ok = tf_add(ops, n, TF_SPACE, 0, 0, 0, 0, 0);
+      f++;
+    } else if(*f != '%') {
+      ok = tf_add(ops, n, TF_LIT, 0, 0, 0, 0, *f++);
+    } else {
+      f++;
+      switch(*f++) {
+      case 'Y': ok = tf_add(ops, n, TF_NUM, F_YEAR, 4, 0, 9999, 0); break;
+      case 'y': ok = tf_add(ops, n, TF_NUM, F_YEAR2, 2, 0, 99, 0); break;
+      case 'm': ok = tf_add(ops, n, TF_NUM, F_MON, 2, 1, 12, 0); break;
+      case 'd':
+      case 'e': ok = tf_add(ops, n, TF_NUM, F_DAY, 2, 1, 31, 0); break;
+      case 'H':
+      case 'k': ok = tf_add(ops, n, TF_NUM, F_HOUR, 2, 0, 23, 0); break;
+      case 'I':
+      case 'l': ok = tf_add(ops, n, TF_NUM, F_HOUR12, 2, 1, 12, 0); break;
+      case 'M': ok = tf_add(ops, n, TF_NUM, F_MIN, 2, 0, 59, 0); break;
+      case 'S': ok = tf_add(ops, n, TF_NUM, F_SEC, 2, 0, 61, 0); break;
+      case 'p': ok = tf_add(ops, n, TF_AMPM, 0, 0, 0, 0, 0); break;
+      case 'z': ok = tf_add(ops, n, TF_ZONE, 0, 0, 0, 0, 0); break;
+      case 'T': ok = tf_piece("%H:%M:%S", ops, n); break;
+      case 'R': ok = tf_piece("%H:%M", ops, n); break;
+      case 'F': ok = tf_piece("%Y-%m-%d", ops, n); break;
+      case 'D': ok = tf_piece("%m/%d/%y", ops, n); break;
+      case 'n':
+      case 't': ok = tf_add(ops, n, TF_SPACE, 0, 0, 0, 0, 0); break;
+      case '%': ok = tf_add(ops, n, TF_LIT, 0, 0, 0, 0, '%'); break;
+      default: ok = false; // leave it to strptime
+      }
+    }
+    if(!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// tf_compile - fmt[0..] (see fmts) as ops or NULL if it can't be
+static struct tf_op* tf_compile(char* fmt[]) {
+  struct tf_op ops[TF_OPS];
+  int n = 0, i;
+  for(i = 0; fmt[i] != NULL; i++) {
+    bool ok;
+    if(fmt[i][0] == '#') { // numeric timestamp
+      ok = tf_add(ops, &n, TF_NUMERIC, 0, 0, 0, 0, 0);
+    } else if(fmt[i][0] == '.') { // subsecond timestamp
+      ok = tf_add(ops, &n, TF_LIT, 0, 0, 0, 0, '.') &&
+	tf_add(ops, &n, TF_FRAC, 0, 0, 0, 0, 0);
+    } else {
+      ok = tf_piece(fmt[i], ops, &n);
+    }
+    if(!ok) {
+      return NULL;
+    }
+  }
+  ops[n++].op = TF_END;
+  struct tf_op* r = malloc(n * sizeof(struct tf_op));
+  if(r != NULL) {
+    memcpy(r, ops, n * sizeof(struct tf_op));
+  }
+  return r;
+}
+
+static inline bool tf_space(char c) {
+  return c == ' ' || ('\t' <= c && c <= '\r');
+}
+
+// tf_run - s in the compiled format op or NOTIME
+static tms tf_run(struct tf_op* op, char* s) {
+  int v[F_N] = { 1900, -1 }; // tm_year 0, no %y
+  bool pm = false, have_i = false, zoned = false;
+  long off = 0; // %z in seconds
+  tms ms = 0;
+  char* p = s;
+  while(tf_space(*p)) {
+    p++;
+  }
+  for(; op->op != TF_END; op++) {
+    switch(op->op) {
+    case TF_NUMERIC:
+      return parse_numeric_ts(s);
+    case TF_SPACE:
+      while(tf_space(*p)) {
+	p++;
+      }
+      break;
+    case TF_LIT:
+      if(*p++ != op->lit) {
+	return NOTIME;
+      }
+      break;
+    case TF_NUM: {
+      while(tf_space(*p)) {
+	p++;
+      }
+      if(!DIGIT(*p)) {
+	return NOTIME;
+      }
+      int x = 0, w = op->width;
+      do {
+	x = x * 10 + (*p++ - '0');
+      } while(--w > 0 && x * 10 <= op->hi && DIGIT(*p));
+      if(x < op->lo || x > op->hi) {
+	return NOTIME;
+      }
+      v[op->field] = x;
+      if(op->field == F_HOUR) {
+	have_i = false;
+      } else if(op->field == F_HOUR12) {
+	v[F_HOUR] = x % 12;
+	have_i = true;
+      }
+      break;
+    }
+    case TF_AMPM: // AM or PM in any case
+      if((p[0] | 0x20) != 'a' && (p[0] | 0x20) != 'p') {
+	return NOTIME;
+      } else if((p[1] | 0x20) != 'm') {
+	return NOTIME;
+      }
+      pm = (p[0] | 0x20) == 'p';
+      p += 2;
+      break;
+    case TF_ZONE: {
+      while(tf_space(*p)) {
+	p++;
+      }
+      zoned = true;
+      if(*p == 'Z') {
+	p++;
+	off = 0;
+	break;
+      }
+      if(*p != '+' && *p != '-') {
+	return NOTIME;
+      }
+      bool neg = *p++ == '-';
+      int x = 0, n = 0;
+      while(n < 4 && DIGIT(*p)) {
+	x = x * 10 + (*p++ - '0');
+	n++;
+	if(*p == ':' && n == 2 && DIGIT(p[1])) {
+	  p++;
+	}
+      }
+      if(n == 2) {
+	x *= 100;
+      } else if(n != 4 || x % 100 >= 60) {
+	return NOTIME;
+      }
+      off = (x / 100) * 3600 + (x % 100) * 60;
+      off = neg ? -off : off;
+      break;
+    }
+    case TF_FRAC: { // keep the first 3 digits exactly
+      if(!DIGIT(*p)) {
+	return NOTIME;
+      }
+      int n;
+      for(n = 0, ms = 0; DIGIT(*p); n++, p++) {
+	if(n < 3) {
+	  ms = ms * 10 + (*p - '0');
+	}
+      }
+      for(; n < 3; n++) {
+	ms *= 10;
+      }
+      break;
+    }
+    }
+  }
+  while(tf_space(*p)) {
+    p++;
+  }
+  if(*p != '\0') {
+    return NOTIME;
+  }
+  long y = v[F_YEAR];
+  if(v[F_YEAR2] >= 0) { // 69..99 are 19xx and the rest 20xx
+    y = v[F_YEAR2] >= 69 ? 1900 + v[F_YEAR2] : 2000 + v[F_YEAR2];
+  }
+  int h = v[F_HOUR] + (have_i && pm ? 12 : 0);
+  long secs = days_from_civil(y, v[F_MON] ? v[F_MON] : 1, v[F_DAY]) * 86400L +
+    h * 3600L + v[F_MIN] * 60L + v[F_SEC] - off;
+  if(!zoned) {
+    secs = tz_to_utc(secs);
+  }
+  return secs * 1000 + ms;
+}
+
 tms parse_numeric_ts(char* s) {
   errno = 0;
   char *endp;
@@ -165,7 +692,7 @@ tms parse_numeric_ts(char* s) {
   return NOTIME;
 }
 
-tms subsec = 0;
+__thread tms subsec = 0;
 
 void init_subsec() {
   subsec = 0;
@@ -175,15 +702,24 @@ tms get_subsec() {
   return subsec;
 }
 
+// parse_subsec - parse .ddd... into ms, digits past the
+//   third are ignored.
 char* parse_subsec(char* in) {
-  float sd;
-  int nc;
-  if(sscanf(in, "%f%n", &sd, &nc) >= 1) { 
-    subsec = (tms) (1000*(sd));
-    return in+nc;
-  } else {
+  if(*in != '.' || !isdigit(in[1])) {
     return NULL;
   }
+  in++;
+  int n;
+  subsec = 0;
+  for(n = 0; isdigit(*in); n++, in++) {
+    if(n < 3) {
+      subsec = subsec * 10 + (*in - '0');
+    }
+  }
+  for(; n < 3; n++) {
+    subsec *= 10;
+  }
+  return in;
 }
 
 char* skip_ws(char* s) { 
@@ -255,7 +791,7 @@ bool parse_t_header(char* s, bool* delta, tms* tsize) {
 }
 
 char* unparse_t_header(bool delta, tms t) {
-  static char buf[80];
+  static __thread char buf[80];
   char* p = buf;
   if(delta) { 
     *p++ = 'd';
@@ -286,36 +822,160 @@ char* unparse_t_header(bool delta, tms t) {
   return buf;
 }
 
-// fmt_* - format a string in a format, note these are not reentrant
-//   but thats not a big problem.
+// fmt_* - format a string in a format, the results and caches are
+//   per thread so separate streams can format in parallel.
+
+// civil_from_days - the inverse of days_from_civil
+static void civil_from_days(long z, long* y, int* m, int* d) {
+  z += 719468;
+  long era = (z >= 0 ? z : z - 146096) / 146097;
+  long doe = z - era * 146097; // [0, 146096]
+  long yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+  long doy = doe - (365*yoe + yoe/4 - yoe/100); // [0, 365]
+  long mp = (5*doy + 2) / 153; // [0, 11]
+  *d = doy - (153*mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = yoe + era * 400 + (*m <= 2);
+}
+
+// tm_from - secs broken down like gmtime_r does but without its lock
+static struct tm* tm_from(long secs, struct tm* tmp) {
+  long day = secs / 86400;
+  long mod = secs % 86400;
+  if(mod < 0) {
+    day--;
+    mod += 86400;
+  }
+  long y;
+  int m, d;
+  civil_from_days(day, &y, &m, &d);
+  memset(tmp, 0, sizeof(*tmp));
+  tmp->tm_year = y - 1900;
+  tmp->tm_mon = m - 1;
+  tmp->tm_mday = d;
+  tmp->tm_hour = mod / 3600;
+  tmp->tm_min = mod / 60 % 60;
+  tmp->tm_sec = mod % 60;
+  tmp->tm_wday = ((day + 4) % 7 + 7) % 7; // 1970-01-01 was a Thursday
+  tmp->tm_yday = day - days_from_civil(y, 1, 1);
+  tmp->tm_zone = "UTC";
+  return tmp;
+}
+
+static inline void put2(char* p, int v) {
+  p[0] = '0' + v / 10;
+  p[1] = '0' + v % 10;
+}
+
+// fmt_t_buf - write t as YYYY-MM-DDTHH:MM:SS[.mmm]Z into buf which
+//   must hold FMT_T_SIZE bytes and return the length (buf is not
+//   terminated).  The YYYY-MM-DDTHH:MM: prefix of the last call is
+//   kept, so sorted data only renders the seconds most of the time
+//   and the hour/minute when the day stays the same.
+int fmt_t_buf(tms t, char* buf) {
+  static __thread long cday = LONG_MIN; // day in cpre
+  static __thread long cmin = LONG_MIN; // minute in cpre
+  static __thread char cpre[17]; // YYYY-MM-DDTHH:MM:
 
-char* fmt_t(tms t) { 
   if(!ISTIME(t)) {
-    return "*";
-  } else {
-    time_t tsecs = (time_t) (t/1000);
-    long subsecs = t % 1000;
-    
-    char buf[80];
-    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", gmtime(&tsecs));
+    buf[0] = '*';
+    return 1;
+  }
+  long secs = t / 1000;
+  int ms = t % 1000;
+  if(ms < 0) { // floor towards -inf for times before 1970
+    secs--;
+    ms += 1000;
+  }
+  long mins = secs / 60;
+  int sec = secs % 60;
+  if(sec < 0) {
+    mins--;
+    sec += 60;
+  }
 
-    char ssbuf[80];
-    if(subsecs != 0) {
-      snprintf(ssbuf, sizeof(ssbuf), ".%03ld", subsecs);
-    } else {
-      ssbuf[0] = '\0';
+  if(mins != cmin) {
+    long day = mins / 1440;
+    int mod = mins % 1440;
+    if(mod < 0) {
+      day--;
+      mod += 1440;
     }
-    
-    static char r[80];
-    snprintf(r, sizeof(r), "%s%sZ", buf, ssbuf);
-    return r;
+    if(day != cday) {
+      long y;
+      int m, d;
+      civil_from_days(day, &y, &m, &d);
+      if(y < 0 || y > 9999) { // too wide for the prefix
+	struct tm tmb;
+	time_t tsecs = secs;
+	int n = strftime(buf, FMT_T_SIZE, "%Y-%m-%dT%H:%M:%S",
+			 gmtime_r(&tsecs, &tmb));
+	if(ms != 0) {
+	  n += snprintf(buf + n, FMT_T_SIZE - n, ".%03d", ms);
+	}
+	buf[n++] = 'Z';
+	return n;
+      }
+      put2(cpre, y / 100);
+      put2(cpre + 2, y % 100);
+      cpre[4] = '-';
+      put2(cpre + 5, m);
+      cpre[7] = '-';
+      put2(cpre + 8, d);
+      cpre[10] = 'T';
+      cpre[13] = ':';
+      cpre[16] = ':';
+      cday = day;
+    }
+    put2(cpre + 11, mod / 60);
+    put2(cpre + 14, mod % 60);
+    cmin = mins;
   }
+
+  memcpy(buf, cpre, sizeof(cpre));
+  char* p = buf + sizeof(cpre);
+  put2(p, sec);
+  p += 2;
+  if(ms != 0) {
+    p[0] = '.';
+    p[1] = '0' + ms / 100;
+    put2(p + 2, ms % 100);
+    p += 4;
+  }
+  *p++ = 'Z';
+  return p - buf;
+}
+
+char* fmt_t(tms t) { 
+  static __thread char r[FMT_T_SIZE + 1];
+  r[fmt_t_buf(t, r)] = '\0';
+  return r;
 }
 
+// fmt_tg - format t using strftime fmt in the -tz zone, the result
+//   for the last second is kept so its only redone when the second
+//   changes.
 char* fmt_tg(tms t, char* fmt) {
-  static char buf[1024];
+  static __thread char buf[1024];
+  static __thread time_t csecs;
+  static __thread char* cfmt_tg = NULL;
+
   time_t tsecs = t/1000;
-  strftime(buf, sizeof(buf), fmt, gmtime(&tsecs));
+  if(fmt != cfmt_tg || tsecs != csecs) {
+    struct tm tmb;
+    bool isdst;
+    char* abbr;
+    long off = tz_offset(tsecs, &isdst, &abbr);
+    tm_from(tsecs + off, &tmb);
+    tmb.tm_isdst = isdst;
+    tmb.tm_gmtoff = off;
+    tmb.tm_zone = abbr;
+    if(strftime(buf, sizeof(buf), fmt, &tmb) == 0) {
+      buf[0] = '\0';
+    }
+    csecs = tsecs;
+    cfmt_tg = fmt;
+  }
   return buf;
 }
 
@@ -340,7 +1000,7 @@ void print_tm(struct tm* tmp) {
 char* fmt_iso8601(struct tm* tmp) {
   char buf[80];
   strftime(buf, sizeof(buf), "%FT%H:%M:%S%z", tmp);
-  static char r[80];
+  static __thread char r[sizeof(buf) + 1];
   snprintf(r, sizeof(r), "%s\n",buf);
   return r;
 }
@@ -350,8 +1010,23 @@ void print_iso8601(struct tm* tmp) {
 }
 
 #ifdef TEST
+// check - the compiled formats must agree with strptime on s
+static int check(char* s) {
+  pthread_once(&ctfs_once, tf_compile_all);
+  int i, bad = 0;
+  for(i = 0; fmts[i][0] != NULL; i++) {
+    if(ctfs[i] != NULL && tf_run(ctfs[i], s) != parse_tf(s, fmts[i])) {
+      printf("fmts[%d] compiled %ld strptime %ld for '%s'\n",
+	     i, tf_run(ctfs[i], s), parse_tf(s, fmts[i]), s);
+      bad++;
+    }
+  }
+  return bad;
+}
+
 int main() {
   char line[80];
+  int bad = 0;
   while(fgets(line, sizeof(line), stdin) != NULL) {
     line[strlen(line)-1] = '\0';
     tms t = parse_t(line);
@@ -359,7 +1034,54 @@ int main() {
 	   line,
 	   t,
 	   fmt_t(t));
+    bad += check(line);
+  }
+  char* odd[] = {
+    "20/06/2014 9:28:42 PM", "1/1/2014 12:00:00 am", "20/06/2014  09:28:42AM",
+    "32/06/2014 9:28:42 AM", "20/13/2014 9:28:42 AM", "20/6/14 9:28:42 AM",
+    " 2014-06-20T09:28:42 ", "2014-6-2T9:8:4", "2014-06-20T09:28:42.5",
+    "2014-06-20T09:28:42.+0100", "2014-06-20T09:28:42.123+01:30",
+    "2014-06-20T09:28:42.123-0530", "2014-06-20T09:28:42.1 Z",
+    "2014-06-20T09:28:42.1+1", "2014-06-20T09:28:60", "2014-02-31",
+    "2014", "2014 +0100", "20140620", "1234567", "-5", "12:34:56",
+    NULL
+  };
+  int i;
+  for(i = 0; odd[i] != NULL; i++) {
+    bad += check(odd[i]);
+  }
+  printf("%d compiled formats differ from strptime\n", bad);
+
+  // parse_digits against strtol for numbers of every length, with
+  // a non digit somewhere in some of them (which it leaves to parse_t)
+  int nbad = 0;
+  srand(1);
+  for(i = 0; i < 1000000; i++) {
+    char num[24];
+    int len = 1 + rand() % 20, k;
+    for(k = 0; k < len; k++) {
+      num[k] = '0' + rand() % 10;
+    }
+    if(rand() % 4 == 0) {
+      num[0] = "+-"[rand() % 2];
+    }
+    if(rand() % 4 == 0) {
+      num[rand() % len] = "x ./:"[rand() % 5];
+    }
+    num[len] = '\0';
+    char* end;
+    errno = 0;
+    long n = strtol(num, &end, 10);
+    tms t = parse_digits(num, len);
+    if(ISTIME(t) && (t != n || *end != '\0' || errno != 0)) {
+      if(nbad++ < 5) {
+	printf("parse_digits '%s' %ld strtol %ld\n", num, t, n);
+      }
+    }
   }
+  printf("%d numeric times differ from strtol\n", nbad);
+  bad += nbad;
+  return bad != 0;
 }
 #endif
 
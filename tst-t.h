@@ -42,10 +42,32 @@ typedef long tms; // time in milliseconds since epoch
 #define NOTIME LONG_MIN // invalid time value
 #define ISTIME(v) ((v) != NOTIME) // 
 
+// where a row t,v[] goes, arg is the caller's context
+typedef void (*emit_fn)(void* arg, tms t, double* v);
+
 tms parse_t(char* s);
+// parse_t for s[0..len-1], faster for numeric times
+tms parse_t_len(char* s, size_t len);
+// how parse_t has got on in this thread: ISO8601 fast path, cached
+// format matched or not, formats tried after a miss and failures
+struct parse_t_counts {
+  long iso, hit, miss, fallback, bad;
+};
+extern __thread struct parse_t_counts parse_t_counts;
+// a user format tried first, false if there are too many
+bool parse_t_format(char* fmt);
+// once this many rows in a row match one format parse_t only tries
+// that one until parse_t_reset (at the start of each file), 0 never
+extern int parse_t_lock;
+void parse_t_reset();
 tms parse_period(char* s);
 tms parse_tf(char* s, char* fmt[]);
+tms parse_iso(char* s, int* fmt);
+bool parse_t_numeric();
+long days_from_civil(long y, int m, int d);
 
+#define FMT_T_SIZE 40 // room for anything fmt_t_buf writes
+int fmt_t_buf(tms t, char* buf);
 char* fmt_t(tms t);
 char* fmt_tg(tms t, char* fmt);
 
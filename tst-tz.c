@@ -0,0 +1,525 @@
+/*
+ * tst-tz.c - time zones from the zoneinfo files as a table of
+ *   offsets so local times convert without mktime or TZ.
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
+
+#include "tst-tz.h"
+#include "tst-t.h"
+
+#define TZ_DIR "/usr/share/zoneinfo"
+#define TZ_MAX (1 << 20) // bigger than any TZif file
+#define TZ_LAST_YEAR 2400 // the rule at the end is expanded to here
+#define TZ_SPAN (2 * 86400L) // more than any offset from UTC
+
+// period - from start (UTC seconds) until the next one starts local
+//   time is off seconds east of UTC, the first one has no start
+struct period {
+  long start;
+  long off;
+  bool isdst;
+  char abbr[7];
+};
+
+static struct period* tzp; // in time order
+static int tzn, tzsize;
+static char* tzname_ = "UTC";
+static char* tzolson = "UTC"; // or NULL for a rule
+static __thread int tzc; // the last period used in this thread
+
+// tz_add - local time is off from start on, merged with the last
+//   period if nothing changes and replacing it if it starts later
+static void tz_add(long start, long off, bool isdst, char* abbr) {
+  if(tzn > 0 && start <= tzp[tzn-1].start) {
+    tzn--;
+  }
+  if(tzn > 0 && tzp[tzn-1].off == off && tzp[tzn-1].isdst == isdst &&
+     strcmp(tzp[tzn-1].abbr, abbr) == 0) {
+    return;
+  }
+  if(tzn == tzsize) {
+    tzsize = tzsize == 0 ? 256 : 2 * tzsize;
+    if((tzp = realloc(tzp, tzsize * sizeof(struct period))) == NULL) {
+      fprintf(stderr, "tst: fatal out of memory in time zone\n");
+      exit(123);
+    }
+  }
+  struct period* p = &tzp[tzn];
+  p->start = tzn == 0 ? LONG_MIN : start;
+  p->off = off;
+  p->isdst = isdst;
+  snprintf(p->abbr, sizeof(p->abbr), "%s", abbr);
+  tzn++;
+}
+
+// The POSIX TZ rule, e.g. AEST-10AEDT,M10.1.0,M4.1.0/3 is AEST at
+// 10h east with AEDT (an hour more) from 2am on the first Sunday in
+// October until 3am on the first Sunday in April.
+
+struct rule {
+  char kind; // 'J' day 1..365 without Feb 29, 'D' day 0..365, 'M'
+  int n, m, w, d; // day n, or day d (Sunday 0) of week w of month m
+  long time; // seconds after midnight local time, may be < 0 or > 24h
+};
+
+// tz_abbr - <...> or 3+ letters into abbr[7]
+static char* tz_abbr(char* s, char* abbr) {
+  char* e;
+  if(*s == '<') {
+    e = strchr(++s, '>');
+    if(e == NULL) {
+      return NULL;
+    }
+  } else {
+    for(e = s; isalpha((unsigned char) *e); e++) {
+    }
+  }
+  if(e - s < 3) {
+    return NULL;
+  }
+  snprintf(abbr, 7, "%.*s", (int) (e - s), s);
+  return *e == '>' ? e + 1 : e;
+}
+
+// tz_hms - [+-]h[:mm[:ss]] as seconds
+static char* tz_hms(char* s, long* secs) {
+  int sign = 1;
+  if(*s == '+' || *s == '-') {
+    sign = *s++ == '-' ? -1 : 1;
+  }
+  if(!isdigit((unsigned char) *s)) {
+    return NULL;
+  }
+  long v = strtol(s, &s, 10) * 3600;
+  if(*s == ':' && isdigit((unsigned char) s[1])) {
+    v += strtol(s + 1, &s, 10) * 60;
+    if(*s == ':' && isdigit((unsigned char) s[1])) {
+      v += strtol(s + 1, &s, 10);
+    }
+  }
+  *secs = sign * v;
+  return s;
+}
+
+// tz_date - Jn, n or Mm.w.d then [/time]
+static char* tz_date(char* s, struct rule* r) {
+  memset(r, 0, sizeof(*r));
+  r->time = 2 * 3600;
+  char* e;
+  if(*s == 'M') {
+    r->kind = 'M';
+    r->m = strtol(s + 1, &e, 10);
+    if(e == s + 1 || *e != '.') {
+      return NULL;
+    }
+    r->w = strtol(s = e + 1, &e, 10);
+    if(e == s || *e != '.') {
+      return NULL;
+    }
+    r->d = strtol(s = e + 1, &e, 10);
+    if(e == s || r->m < 1 || r->m > 12 || r->w < 1 || r->w > 5 ||
+       r->d < 0 || r->d > 6) {
+      return NULL;
+    }
+  } else {
+    r->kind = *s == 'J' ? 'J' : 'D';
+    s += *s == 'J';
+    r->n = strtol(s, &e, 10);
+    if(e == s || r->n < (r->kind == 'J') || r->n > 365) {
+      return NULL;
+    }
+  }
+  if(*e == '/') {
+    e = tz_hms(e + 1, &r->time);
+  }
+  return e;
+}
+
+static bool leap(long y) {
+  return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+// rule_local - when r happens in year y as seconds of local time
+static long rule_local(struct rule* r, long y) {
+  long day;
+  if(r->kind == 'J') {
+    day = days_from_civil(y, 1, r->n + (leap(y) && r->n >= 60));
+  } else if(r->kind == 'D') {
+    day = days_from_civil(y, 1, 1 + r->n);
+  } else {
+    long first = days_from_civil(y, r->m, 1);
+    long dim = days_from_civil(y + (r->m == 12), r->m % 12 + 1, 1) - first;
+    int wd = ((first + 4) % 7 + 7) % 7; // 1970-01-01 was a Thursday
+    day = (r->d - wd + 7) % 7 + (r->w - 1) * 7;
+    while(day >= dim) { // week 5 is the last one
+      day -= 7;
+    }
+    day += first;
+  }
+  return day * 86400 + r->time;
+}
+
+// tz_rule - add the periods for rule s after the last one up to
+//   TZ_LAST_YEAR, from 1900 if there aren't any yet.
+static bool tz_rule(char* s) {
+  char std[7], dst[7];
+  long stdoff, dstoff;
+  struct rule r[2];
+  if((s = tz_abbr(s, std)) == NULL || (s = tz_hms(s, &stdoff)) == NULL) {
+    return false;
+  }
+  stdoff = -stdoff; // POSIX offsets are west of UTC
+  if(*s == '\0') { // no daylight saving
+    if(tzn == 0) {
+      tz_add(LONG_MIN, stdoff, false, std);
+    }
+    return true;
+  }
+  if((s = tz_abbr(s, dst)) == NULL) {
+    return false;
+  }
+  dstoff = stdoff + 3600;
+  if(*s != ',' && *s != '\0') {
+    if((s = tz_hms(s, &dstoff)) == NULL) {
+      return false;
+    }
+    dstoff = -dstoff;
+  }
+  if(*s == '\0') { // the US rules
+    s = ",M3.2.0,M11.1.0";
+  }
+  if(*s != ',' || (s = tz_date(s + 1, &r[0])) == NULL ||
+     *s != ',' || (s = tz_date(s + 1, &r[1])) == NULL || *s != '\0') {
+    return false;
+  }
+
+  long last = tzn > 0 ? tzp[tzn-1].start : LONG_MIN;
+  long y = tzn > 1 ? 1970 + last / (366 * 86400L) - 1 : 1900;
+  for(; y <= TZ_LAST_YEAR; y++) {
+    long on = rule_local(&r[0], y) - stdoff; // starts in standard time
+    long off = rule_local(&r[1], y) - dstoff;
+    if(tzn == 0) { // what it was before, south of the equator DST
+      if(off < on) { // runs over new year
+	tz_add(LONG_MIN, dstoff, true, dst);
+      } else {
+	tz_add(LONG_MIN, stdoff, false, std);
+      }
+    }
+    if(off < on) {
+      if(off > last) {
+	tz_add(off, stdoff, false, std);
+      }
+      if(on > last) {
+	tz_add(on, dstoff, true, dst);
+      }
+    } else {
+      if(on > last) {
+	tz_add(on, dstoff, true, dst);
+      }
+      if(off > last) {
+	tz_add(off, stdoff, false, std);
+      }
+    }
+  }
+  return true;
+}
+
+// be - the n byte big endian signed number at p
+static long be(unsigned char* p, int n) {
+  uint64_t v = 0;
+  int i;
+  for(i = 0; i < n; i++) {
+    v = v << 8 | p[i];
+  }
+  return n == 4 ? (long) (int32_t) v : (long) (int64_t) v;
+}
+
+// tz_tzif - the periods in TZif file b (RFC 8536), the 64 bit
+//   data from version 2 on and the rule at the end after that
+static bool tz_tzif(unsigned char* b, size_t len) {
+  int w = 4; // bytes in a time
+  long cnt[6]; // isutcnt isstdcnt leapcnt timecnt typecnt charcnt
+  size_t size;
+  for(;;) {
+    if(len < 44 || memcmp(b, "TZif", 4) != 0) {
+      return false;
+    }
+    int i;
+    for(i = 0; i < 6; i++) {
+      if((cnt[i] = be(b + 20 + 4 * i, 4)) < 0) {
+	return false;
+      }
+    }
+    size = 44 + cnt[3] * (w + 1) + cnt[4] * 6 + cnt[5] +
+      cnt[2] * (w + 4) + cnt[1] + cnt[0];
+    if(size > len || cnt[4] < 1) {
+      return false;
+    }
+    if(w == 8 || b[4] < '2') {
+      break;
+    }
+    b += size; // skip the 32 bit version
+    len -= size;
+    w = 8;
+  }
+
+  unsigned char* times = b + 44;
+  unsigned char* idx = times + cnt[3] * w;
+  unsigned char* types = idx + cnt[3];
+  char* chars = (char*) types + cnt[4] * 6;
+  long j;
+  for(j = -1; j < cnt[3]; j++) {
+    int k = j < 0 ? 0 : idx[j]; // type 0 before the first one
+    if(k >= cnt[4] || types[6*k + 5] >= cnt[5] ||
+       memchr(chars + types[6*k + 5], '\0', cnt[5] - types[6*k + 5]) == NULL) {
+      return false;
+    }
+    tz_add(j < 0 ? LONG_MIN : be(times + j * w, w), be(types + 6*k, 4),
+	   types[6*k + 4] != 0, chars + types[6*k + 5]);
+  }
+
+  char* rule = (char*) b + size; // \nrule\n
+  char* end;
+  if(w == 8 && size < len && *rule == '\n' &&
+     (end = memchr(rule + 1, '\n', len - size - 1)) != NULL && end > rule + 1) {
+    *end = '\0';
+    return tz_rule(rule + 1);
+  }
+  return true;
+}
+
+// tz_olson_name - the zoneinfo name of a file, e.g. Europe/Paris for
+//   /usr/share/zoneinfo/posix/Europe/Paris, NULL if it isn't under a
+//   zoneinfo directory
+static char* tz_olson_name(char* name) {
+  if(name[0] != '/') {
+    return name;
+  }
+  char* z = NULL, *p;
+  for(p = name; (p = strstr(p, "/zoneinfo/")) != NULL; p++) {
+    z = p + strlen("/zoneinfo/");
+  }
+  if(z != NULL && (strncmp(z, "posix/", 6) == 0 ||
+		   strncmp(z, "right/", 6) == 0)) {
+    z += 6;
+  }
+  return z != NULL && *z != '\0' ? z : NULL;
+}
+
+bool tz_load(char* name) {
+  tzn = 0;
+  tzc = 0;
+  tzname_ = tzolson = "UTC";
+  if(strcmp(name, "UTC") == 0 || name[0] == '\0') {
+    return true;
+  }
+  char path[4096];
+  snprintf(path, sizeof(path), "%s%s%s", name[0] == '/' ? "" : TZ_DIR,
+	   name[0] == '/' ? "" : "/", name);
+  FILE* fp = strstr(name, "..") == NULL ? fopen(path, "r") : NULL;
+  bool ok, file = fp != NULL;
+  if(file) {
+    unsigned char* b = malloc(TZ_MAX);
+    size_t len = b != NULL ? fread(b, 1, TZ_MAX, fp) : 0;
+    fclose(fp);
+    ok = len < TZ_MAX && tz_tzif(b, len);
+    free(b);
+  } else {
+    ok = tz_rule(name);
+  }
+  if(!ok || tzn == 0) {
+    tzn = 0;
+    tzolson = "UTC";
+    return false;
+  }
+  tzname_ = name;
+  tzolson = file ? tz_olson_name(name) : NULL;
+  return true;
+}
+
+char* tz_name() {
+  return tzname_;
+}
+
+char* tz_olson() {
+  return tzolson;
+}
+
+// tz_find - the last period starting at or before t
+static int tz_find(long t) {
+  int lo = 0, hi = tzn - 1;
+  while(lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if(tzp[mid].start <= t) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+long tz_offset(long utc, bool* isdst, char** abbr) {
+  if(tzn == 0) {
+    if(isdst != NULL) {
+      *isdst = false;
+    }
+    if(abbr != NULL) {
+      *abbr = "UTC";
+    }
+    return 0;
+  }
+  int i = tzc;
+  if(i >= tzn || tzp[i].start > utc || (i + 1 < tzn && utc >= tzp[i+1].start)) {
+    tzc = i = tz_find(utc);
+  }
+  if(isdst != NULL) {
+    *isdst = tzp[i].isdst;
+  }
+  if(abbr != NULL) {
+    *abbr = tzp[i].abbr;
+  }
+  return tzp[i].off;
+}
+
+long tz_to_utc(long local) {
+  if(tzn == 0) {
+    return local;
+  }
+  // sorted times stay well inside the last period
+  int i = tzc;
+  long u;
+  if(i < tzn) {
+    u = local - tzp[i].off;
+    if((i == 0 || tzp[i].start <= u - TZ_SPAN) &&
+       (i + 1 == tzn || u + TZ_SPAN < tzp[i+1].start)) {
+      return u;
+    }
+  }
+  // else the first period it fits in or the one before a gap
+  int late = i = tz_find(local - TZ_SPAN);
+  for(; i < tzn && (i == 0 || tzp[i].start <= local + TZ_SPAN); i++) {
+    u = local - tzp[i].off;
+    if(i > 0 && u < tzp[i].start) {
+      continue;
+    }
+    late = i;
+    if(i + 1 == tzn || u < tzp[i+1].start) {
+      tzc = i;
+      return u;
+    }
+  }
+  return local - tzp[late].off;
+}
+
+#ifdef TEST
+#include <time.h>
+
+// differs - tz_offset isn't glibc's localtime_r offset at u or
+//   tz_to_utc doesn't take the local time back to u (or the first
+//   time it happened if it happened twice)
+static bool differs(char* zone, long u) {
+  struct tm tmb;
+  time_t tu = u;
+  localtime_r(&tu, &tmb);
+  long off = tz_offset(u, NULL, NULL);
+  long v = tz_to_utc(u + off);
+  if(off != tmb.tm_gmtoff || v > u || v + tz_offset(v, NULL, NULL) != u + off) {
+    printf("%s %ld: offset %ld glibc %ld back %ld\n", zone, u, off,
+	   tmb.tm_gmtoff, v);
+    return true;
+  }
+  return false;
+}
+
+// check - zone against glibc every 7h 3m from 1900 to 2300 and
+//   either side of each change, the number that differ
+static int check(char* zone) {
+  static char env[256];
+  snprintf(env, sizeof(env), "TZ=:%s", zone);
+  putenv(env);
+  tzset();
+  if(!tz_load(zone)) {
+    printf("%s didn't load\n", zone);
+    return 1;
+  }
+  int bad = 0, i;
+  long u, n = 0;
+  long end = days_from_civil(2300, 1, 1) * 86400;
+  for(u = days_from_civil(1900, 1, 1) * 86400; u < end; u += 7 * 3600 + 180) {
+    bad += differs(zone, u);
+    n++;
+  }
+  for(i = 1; i < tzn && tzp[i].start < end; i++) {
+    bad += differs(zone, tzp[i].start - 1) + differs(zone, tzp[i].start);
+    n += 2;
+  }
+  printf("%s %ld times %d differ\n", zone, n, bad);
+  return bad;
+}
+
+int main() {
+  char* zones[] = {
+    "UTC", "Australia/Sydney", "Australia/Perth", "Australia/Lord_Howe",
+    "Europe/London", "Europe/Dublin", "America/New_York", "America/Sao_Paulo",
+    "Asia/Kolkata", "Pacific/Chatham", "Africa/Casablanca", NULL
+  };
+  int bad = 0, i;
+  for(i = 0; zones[i] != NULL; i++) {
+    bad += check(zones[i]);
+  }
+
+  // a rule on its own is the same as the zone it came from
+  tz_load("Australia/Sydney");
+  long s[4], u = days_from_civil(2010, 1, 1) * 86400;
+  for(i = 0; i < 4; i++) {
+    s[i] = tz_offset(u + i * 91 * 86400L, NULL, NULL);
+  }
+  tz_load("AEST-10AEDT,M10.1.0,M4.1.0/3");
+  for(i = 0; i < 4; i++) {
+    bad += s[i] != tz_offset(u + i * 91 * 86400L, NULL, NULL);
+  }
+  bad += tz_olson() != NULL;
+  // paths are known by their zoneinfo name
+  tz_load(TZ_DIR "/posix/Europe/Paris");
+  bad += tz_olson() == NULL || strcmp(tz_olson(), "Europe/Paris") != 0;
+  bad += tz_load("Nowhere/Special") || tz_load("EST5EDT,M3") ||
+    !tz_load("UTC") || tz_to_utc(1234) != 1234;
+  printf("%d time zones differ\n", bad);
+  return bad != 0;
+}
+#endif
@@ -0,0 +1,63 @@
+/*
+ * tst-tz.h - time zones for times written without an offset
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _TST_TZ_H_
+#define _TST_TZ_H_ 1
+
+#include <stdbool.h>
+
+// The zone (-tz) is loaded once from its zoneinfo (TZif) file into
+// a table of the periods between offset changes, with the rule at
+// the end of the file expanded out to 2400, and then only read so
+// any thread can use it and TZ doesn't matter.  Until tz_load is
+// called (or after tz_load("UTC")) everything is UTC.
+
+// tz_load - name is UTC, a zone under /usr/share/zoneinfo such as
+//   Australia/Sydney, a path to a TZif file or a POSIX TZ rule such
+//   as AEST-10AEDT,M10.1.0,M4.1.0/3, false if it can't be loaded
+bool tz_load(char* name);
+char* tz_name(); // what was loaded, UTC to start with
+// tz_olson - the zone's tz database name such as Europe/Paris even
+//   if it was loaded from a path, NULL if it came from a POSIX rule
+//   or a file outside a zoneinfo directory
+char* tz_olson();
+
+// tz_to_utc - seconds of local time to UTC, a local time that
+//   happens twice (clocks going back) is the first of them and one
+//   that never happens (clocks going forward) is read with the
+//   offset from before the change, like mktime
+long tz_to_utc(long local);
+// tz_offset - seconds east of UTC at utc, *isdst and *abbr (e.g.
+//   AEDT) are set if they aren't NULL
+long tz_offset(long utc, bool* isdst, char** abbr);
+
+#endif /* _TST_TZ_H_ */
@@ -0,0 +1,294 @@
+/*
+ * tst-write.c - block buffered output for tst, records are
+ *   appended to a large buffer and written with write/writev.
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "tst-t.h"
+#include "tst-write.h"
+#include "tst-z.h"
+#include "tst-stats.h"
+
+#define WR_SIZE (256 * 1024) // output buffer size
+
+static int wr_fd = 1;
+static char wr_buf[WR_SIZE];
+static size_t wr_n; // bytes used in wr_buf
+
+static enum { WR_SIZE_POLICY, WR_LINE_POLICY, WR_TIME_POLICY } wr_policy;
+static tms wr_period; // for WR_TIME_POLICY
+static tms wr_last; // time of last flush
+static struct zw* wr_z; // compressing the output
+static long wr_total; // bytes written so far
+static bool wr_timed; // count the cycles in wr_cycles for -stats
+static unsigned long wr_cycles;
+
+static tms wr_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// wr_exit - flush and finish off any compressed stream
+static void wr_exit() {
+  wr_flush();
+  if(wr_z != NULL) {
+    z_write_close(wr_z);
+    wr_z = NULL;
+  }
+}
+
+void wr_init(int fd, char* policy) {
+  fflush(stdout); // anything printf'd so far goes first
+  wr_fd = fd;
+  wr_n = 0;
+  wr_z = NULL; // e.g. after a fork, the thread didn't come with us
+  if(strcmp(policy, "auto") == 0) {
+    wr_policy = isatty(fd) ? WR_LINE_POLICY : WR_SIZE_POLICY;
+  } else if(strcmp(policy, "size") == 0) {
+    wr_policy = WR_SIZE_POLICY;
+  } else if(strcmp(policy, "line") == 0) {
+    wr_policy = WR_LINE_POLICY;
+  } else {
+    wr_policy = WR_TIME_POLICY;
+    wr_period = parse_period(policy);
+    wr_last = wr_now();
+  }
+  static bool registered = false;
+  if(!registered) {
+    atexit(wr_exit);
+    registered = true;
+  }
+}
+
+void wr_compress(int codec) {
+  if(codec != Z_PLAIN) {
+    wr_z = z_write_open(wr_fd, codec);
+  }
+}
+
+void wr_stats(bool timed) {
+  wr_timed = timed;
+  wr_total = 0;
+  wr_cycles = 0;
+}
+
+long wr_bytes(unsigned long* cycles) {
+  *cycles = wr_cycles;
+  return wr_total;
+}
+
+static void wr_writev1(struct iovec* iov, int n);
+
+// write all of iov[0..n-1] to wr_fd
+static void wr_writev(struct iovec* iov, int n) {
+  int i;
+  for(i = 0; i < n; i++) {
+    wr_total += iov[i].iov_len;
+  }
+  if(wr_timed) {
+    unsigned long c0 = stats_clock();
+    wr_writev1(iov, n);
+    wr_cycles += stats_clock() - c0;
+  } else {
+    wr_writev1(iov, n);
+  }
+}
+
+static void wr_writev1(struct iovec* iov, int n) {
+  if(wr_z != NULL) { // the compression thread does the writing
+    int i;
+    for(i = 0; i < n; i++) {
+      z_write(wr_z, iov[i].iov_base, iov[i].iov_len,
+	      i == n - 1 && wr_policy != WR_SIZE_POLICY);
+    }
+    return;
+  }
+  while(n > 0) {
+    ssize_t r = writev(wr_fd, iov, n);
+    if(r < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      fprintf(stderr, "tst: fatal error writing output: %s\n",
+	      strerror(errno));
+      wr_n = 0; // so the atexit flush doesn't try again
+      exit(104);
+    }
+    while(n > 0 && (size_t) r >= iov->iov_len) {
+      r -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if(n > 0) {
+      iov->iov_base = (char*) iov->iov_base + r;
+      iov->iov_len -= r;
+    }
+  }
+}
+
+void wr_flush() {
+  if(wr_n > 0) {
+    struct iovec iov = { wr_buf, wr_n };
+    wr_n = 0;
+    wr_writev(&iov, 1);
+  }
+}
+
+void wr_mem(const char* p, size_t n) {
+  if(wr_n + n <= WR_SIZE) {
+    memcpy(wr_buf + wr_n, p, n);
+    wr_n += n;
+  } else if(n < WR_SIZE / 2) {
+    wr_flush();
+    memcpy(wr_buf, p, n);
+    wr_n = n;
+  } else { // too big to be worth copying
+    struct iovec iov[2] = { { wr_buf, wr_n }, { (char*) p, n } };
+    wr_n = 0;
+    wr_writev(iov, 2);
+  }
+}
+
+void wr_str(const char* s) {
+  wr_mem(s, strlen(s));
+}
+
+void wr_char(char c) {
+  if(wr_n == WR_SIZE) {
+    wr_flush();
+  }
+  wr_buf[wr_n++] = c;
+}
+
+void wr_long(long v) {
+  char* p = wr_reserve(24);
+  char* e = p + 24;
+  char* q = e;
+  unsigned long u = v < 0 ? -(unsigned long) v : (unsigned long) v;
+  do {
+    *--q = '0' + u % 10;
+    u /= 10;
+  } while(u != 0);
+  if(v < 0) {
+    *--q = '-';
+  }
+  size_t n = e - q;
+  memmove(p, q, n);
+  wr_commit(n);
+}
+
+// wr_t - t in ISO8601 formatted straight into the buffer
+void wr_t(tms t) {
+  wr_commit(fmt_t_buf(t, wr_reserve(FMT_T_SIZE)));
+}
+
+void wr_printf(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(wr_buf + wr_n, WR_SIZE - wr_n, fmt, ap);
+  va_end(ap);
+  if(n < 0) {
+    return;
+  } else if(wr_n + n < WR_SIZE) {
+    wr_n += n;
+  } else { // didn't fit, so make room and do it again
+    wr_flush();
+    char* p = n < WR_SIZE ? wr_buf : malloc(n + 1);
+    va_start(ap, fmt);
+    vsnprintf(p, n + 1, fmt, ap);
+    va_end(ap);
+    if(p == wr_buf) {
+      wr_n = n;
+    } else {
+      wr_mem(p, n);
+      free(p);
+    }
+  }
+}
+
+char* wr_reserve(size_t n) {
+  if(wr_n + n > WR_SIZE) {
+    wr_flush();
+  }
+  return wr_buf + wr_n;
+}
+
+void wr_commit(size_t n) {
+  wr_n += n;
+}
+
+void wr_endrec() {
+  switch(wr_policy) {
+  case WR_SIZE_POLICY:
+    break;
+  case WR_LINE_POLICY:
+    wr_flush();
+    break;
+  case WR_TIME_POLICY:
+    if(wr_n > 0) {
+      tms now = wr_now();
+      if(now - wr_last >= wr_period) {
+	wr_flush();
+	wr_last = now;
+      }
+    }
+    break;
+  }
+}
+
+#ifdef TEST
+int main() {
+  wr_init(1, "size");
+  wr_str("hello");
+  wr_char(' ');
+  wr_long(-1234567890);
+  wr_char(' ');
+  wr_long(0);
+  wr_char(' ');
+  wr_t(981173106789);
+  wr_printf(" %g %s\n", 1.5, "printf");
+  wr_endrec();
+  int i;
+  for(i = 0; i < 100000; i++) { // a few buffers worth
+    wr_printf("%d\n", i);
+  }
+  wr_flush();
+  return 0;
+}
+#endif
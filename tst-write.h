@@ -0,0 +1,73 @@
+/*
+ * tst-write.h - block buffered output for tst
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TST_WRITE_H_
+#define _TST_WRITE_H_ 1
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "tst-t.h"
+
+// output is appended to one large buffer which is handed to
+// write(2) according to the flush policy:
+//   size  - only when the buffer fills (the default for files/pipes)
+//   line  - at the end of every record (the default for ttys)
+//   auto  - line if fd is a tty otherwise size
+//   <period> - e.g. 500ms or 2s, when that long has passed since
+//     the last flush
+void wr_init(int fd, char* policy);
+void wr_flush();
+// wr_compress - compress everything from now on with codec (see
+//   tst-z.h) on a thread of its own, flushes also flush the codec
+//   unless the policy is size.
+void wr_compress(int codec);
+
+void wr_mem(const char* p, size_t n);
+void wr_str(const char* s);
+void wr_char(char c);
+void wr_long(long v);
+void wr_t(tms t); // as ISO8601 like fmt_t
+void wr_printf(const char* fmt, ...)
+  __attribute__ ((format (printf, 1, 2)));
+
+// reserve n bytes to format directly into, then commit what was used
+char* wr_reserve(size_t n);
+void wr_commit(size_t n);
+
+void wr_endrec(); // end of a record, apply the flush policy
+
+// bytes handed to write(2) (or the compressor) so far and, after
+// wr_stats(true), the cycles spent doing it; wr_stats starts both
+// again from zero
+void wr_stats(bool timed);
+long wr_bytes(unsigned long* cycles);
+
+#endif /* _TST_WRITE_H_ */
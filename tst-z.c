@@ -0,0 +1,551 @@
+/*
+ * tst-z.c - gzip/zstd compressed input and output, the codec runs
+ *   on its own thread feeding (or fed by) a bounded buffer queue.
+ *
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE 1 // for fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "tst-z.h"
+
+#define ZQ_BUFS 4 // buffers in a queue
+#define ZQ_SIZE (256 * 1024) // bytes in each
+
+static void z_fatal(char* what, const char* why) {
+  fprintf(stderr, "tst: fatal %s: %s\n", what, why);
+  // we may be on a codec thread, the atexit handlers would wait
+  // for it to finish
+  _exit(113);
+}
+
+static void* z_alloc(size_t n) {
+  void* p = malloc(n);
+  if(p == NULL) {
+    z_fatal("out of memory", "compression buffers");
+  }
+  return p;
+}
+
+int z_codec(const unsigned char* p, size_t n) {
+  if(n >= 2 && p[0] == 0x1f && p[1] == 0x8b) {
+    return Z_GZIP;
+  } else if(n >= 4 && p[0] == 0x28 && p[1] == 0xb5 &&
+	    p[2] == 0x2f && p[3] == 0xfd) {
+    return Z_ZSTD;
+  }
+  return Z_PLAIN;
+}
+
+int z_codec_name(char* name) {
+  if(strcmp(name, "none") == 0) {
+    return Z_PLAIN;
+  } else if(strcmp(name, "gzip") == 0) {
+    return Z_GZIP;
+  } else if(strcmp(name, "zstd") == 0) {
+    return Z_ZSTD;
+  }
+  return -1;
+}
+
+// the queue, the producer fills buffers and puts them, the
+// consumer takes them and releases them once it's done.
+
+struct zbuf {
+  char* p;
+  size_t n;
+  bool sync; // flush the compressor after this one
+};
+
+struct zq {
+  pthread_mutex_t m;
+  pthread_cond_t c;
+  struct zbuf b[ZQ_BUFS];
+  int head; // next to take
+  int count; // full buffers from head on
+  bool done; // nothing more will be put
+  bool stop; // the consumer has gone, stop producing
+};
+
+static void zq_init(struct zq* q) {
+  memset(q, 0, sizeof(*q));
+  pthread_mutex_init(&q->m, NULL);
+  pthread_cond_init(&q->c, NULL);
+  int i;
+  for(i = 0; i < ZQ_BUFS; i++) {
+    q->b[i].p = z_alloc(ZQ_SIZE);
+  }
+}
+
+static void zq_free(struct zq* q) {
+  int i;
+  for(i = 0; i < ZQ_BUFS; i++) {
+    free(q->b[i].p);
+  }
+  pthread_mutex_destroy(&q->m);
+  pthread_cond_destroy(&q->c);
+}
+
+// zq_empty - wait for an empty buffer to fill, NULL if told to stop
+static struct zbuf* zq_empty(struct zq* q) {
+  pthread_mutex_lock(&q->m);
+  while(q->count == ZQ_BUFS && !q->stop) {
+    pthread_cond_wait(&q->c, &q->m);
+  }
+  struct zbuf* b = q->stop ? NULL : &q->b[(q->head + q->count) % ZQ_BUFS];
+  pthread_mutex_unlock(&q->m);
+  if(b != NULL) {
+    b->n = 0;
+    b->sync = false;
+  }
+  return b;
+}
+
+static void zq_put(struct zq* q) {
+  pthread_mutex_lock(&q->m);
+  q->count++;
+  pthread_cond_broadcast(&q->c);
+  pthread_mutex_unlock(&q->m);
+}
+
+// zq_take - wait for a full buffer, NULL once they're all done
+static struct zbuf* zq_take(struct zq* q) {
+  pthread_mutex_lock(&q->m);
+  while(q->count == 0 && !q->done) {
+    pthread_cond_wait(&q->c, &q->m);
+  }
+  struct zbuf* b = q->count > 0 ? &q->b[q->head] : NULL;
+  pthread_mutex_unlock(&q->m);
+  return b;
+}
+
+static void zq_release(struct zq* q) {
+  pthread_mutex_lock(&q->m);
+  q->head = (q->head + 1) % ZQ_BUFS;
+  q->count--;
+  pthread_cond_broadcast(&q->c);
+  pthread_mutex_unlock(&q->m);
+}
+
+static void zq_set(struct zq* q, bool* flag) {
+  pthread_mutex_lock(&q->m);
+  *flag = true;
+  pthread_cond_broadcast(&q->c);
+  pthread_mutex_unlock(&q->m);
+}
+
+// input
+
+struct zr {
+  struct zq q;
+  int fd;
+  int codec;
+  pthread_t tid;
+  char prefix[8]; // bytes already read from fd
+  size_t pos_prefix; // how many we've handed out
+  size_t nprefix;
+  struct zbuf* cur; // being read from
+  size_t pos;
+};
+
+// z_in - read up to n compressed bytes, prefix first
+static ssize_t z_in(struct zr* z, char* p, size_t n) {
+  if(z->pos_prefix < z->nprefix) {
+    size_t k = z->nprefix - z->pos_prefix;
+    n = n < k ? n : k;
+    memcpy(p, z->prefix + z->pos_prefix, n);
+    z->pos_prefix += n;
+    return n;
+  }
+  ssize_t r;
+  while((r = read(z->fd, p, n)) < 0 && errno == EINTR) {
+  }
+  if(r < 0) {
+    z_fatal("error reading input", strerror(errno));
+  }
+  return r;
+}
+
+static void* gzip_reader(void* arg) {
+  struct zr* z = arg;
+  char* in = z_alloc(ZQ_SIZE);
+  z_stream s;
+  memset(&s, 0, sizeof(s));
+  if(inflateInit2(&s, 15 + 32) != Z_OK) { // gzip or zlib header
+    z_fatal("cannot start gzip", s.msg ? s.msg : "inflateInit");
+  }
+  struct zbuf* b = NULL;
+  bool eof = false;
+  for(;;) {
+    if(s.avail_in == 0 && !eof) {
+      ssize_t r = z_in(z, in, ZQ_SIZE);
+      s.next_in = (Bytef*) in;
+      s.avail_in = r;
+      eof = r == 0;
+    }
+    if(b == NULL && (b = zq_empty(&z->q)) == NULL) {
+      break; // nobody wants the rest
+    }
+    s.next_out = (Bytef*) b->p + b->n;
+    s.avail_out = ZQ_SIZE - b->n;
+    int rc = inflate(&s, Z_NO_FLUSH);
+    b->n = ZQ_SIZE - s.avail_out;
+    if(rc == Z_STREAM_END) { // maybe another member follows
+      if(s.avail_in == 0 && !eof) {
+	ssize_t r = z_in(z, in, ZQ_SIZE);
+	s.next_in = (Bytef*) in;
+	s.avail_in = r;
+	eof = r == 0;
+      }
+      if(s.avail_in == 0) {
+	break;
+      }
+      inflateReset(&s);
+    } else if(rc == Z_BUF_ERROR && eof && s.avail_in == 0) {
+      z_fatal("corrupt gzip input", "truncated");
+    } else if(rc != Z_OK && rc != Z_BUF_ERROR) {
+      z_fatal("corrupt gzip input", s.msg ? s.msg : "inflate");
+    }
+    if(b->n == ZQ_SIZE) {
+      zq_put(&z->q);
+      b = NULL;
+    }
+  }
+  if(b != NULL && b->n > 0) {
+    zq_put(&z->q);
+  }
+  inflateEnd(&s);
+  free(in);
+  zq_set(&z->q, &z->q.done);
+  return NULL;
+}
+
+#ifdef HAVE_ZSTD
+static void* zstd_reader(void* arg) {
+  struct zr* z = arg;
+  char* in = z_alloc(ZQ_SIZE);
+  ZSTD_DStream* ds = ZSTD_createDStream();
+  ZSTD_initDStream(ds);
+  ZSTD_inBuffer ib = { in, 0, 0 };
+  struct zbuf* b = NULL;
+  size_t rc = 1; // 0 at the end of a frame
+  for(;;) {
+    if(ib.pos == ib.size) {
+      ssize_t r = z_in(z, in, ZQ_SIZE);
+      if(r == 0) {
+	if(rc != 0) {
+	  z_fatal("corrupt zstd input", "truncated");
+	}
+	break;
+      }
+      ib.size = r;
+      ib.pos = 0;
+    }
+    if(b == NULL && (b = zq_empty(&z->q)) == NULL) {
+      break;
+    }
+    ZSTD_outBuffer ob = { b->p, ZQ_SIZE, b->n };
+    rc = ZSTD_decompressStream(ds, &ob, &ib);
+    if(ZSTD_isError(rc)) {
+      z_fatal("corrupt zstd input", ZSTD_getErrorName(rc));
+    }
+    b->n = ob.pos;
+    if(b->n == ZQ_SIZE) {
+      zq_put(&z->q);
+      b = NULL;
+    }
+  }
+  if(b != NULL && b->n > 0) {
+    zq_put(&z->q);
+  }
+  ZSTD_freeDStream(ds);
+  free(in);
+  zq_set(&z->q, &z->q.done);
+  return NULL;
+}
+#endif
+
+static ssize_t zr_read(void* cookie, char* buf, size_t size) {
+  struct zr* z = cookie;
+  if(z->codec == Z_PLAIN) { // nothing to do but hand out the prefix
+    return z_in(z, buf, size);
+  }
+  size_t got = 0;
+  while(got < size) {
+    if(z->cur == NULL && (z->cur = zq_take(&z->q)) == NULL) {
+      break;
+    }
+    size_t k = z->cur->n - z->pos;
+    k = k < size - got ? k : size - got;
+    memcpy(buf + got, z->cur->p + z->pos, k);
+    got += k;
+    z->pos += k;
+    if(z->pos == z->cur->n) {
+      zq_release(&z->q);
+      z->cur = NULL;
+      z->pos = 0;
+    }
+  }
+  return got;
+}
+
+static int zr_close(void* cookie) {
+  struct zr* z = cookie;
+  if(z->codec != Z_PLAIN) {
+    zq_set(&z->q, &z->q.stop);
+    pthread_join(z->tid, NULL);
+    zq_free(&z->q);
+  }
+  if(z->fd > 2) {
+    close(z->fd);
+  }
+  free(z);
+  return 0;
+}
+
+FILE* z_read(int fd, int codec, const char* prefix, size_t n) {
+  struct zr* z = z_alloc(sizeof(*z));
+  memset(z, 0, sizeof(*z));
+  z->fd = fd;
+  z->codec = codec;
+  z->nprefix = n < sizeof(z->prefix) ? n : sizeof(z->prefix);
+  if(n > 0) {
+    memcpy(z->prefix, prefix, z->nprefix);
+  }
+  if(codec != Z_PLAIN) {
+    void* (*reader)(void*) = gzip_reader;
+#ifdef HAVE_ZSTD
+    if(codec == Z_ZSTD) {
+      reader = zstd_reader;
+    }
+#else
+    if(codec == Z_ZSTD) {
+      z_fatal("cannot read zstd input", "built without HAVE_ZSTD");
+    }
+#endif
+    zq_init(&z->q);
+    if(pthread_create(&z->tid, NULL, reader, z) != 0) {
+      z_fatal("cannot start decompression thread", strerror(errno));
+    }
+  }
+  cookie_io_functions_t io = { zr_read, NULL, NULL, zr_close };
+  FILE* fp = fopencookie(z, "r", io);
+  if(fp == NULL) {
+    z_fatal("cannot open decompressed stream", strerror(errno));
+  }
+  return fp;
+}
+
+// output
+
+struct zw {
+  struct zq q;
+  int fd;
+  int codec;
+  pthread_t tid;
+  struct zbuf* fill; // being filled by z_write
+};
+
+// z_out - write all of p[0..n-1] to fd
+static void z_out(struct zw* z, char* p, size_t n) {
+  while(n > 0) {
+    ssize_t r = write(z->fd, p, n);
+    if(r < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      fprintf(stderr, "tst: fatal error writing output: %s\n",
+	      strerror(errno));
+      _exit(104);
+    }
+    p += r;
+    n -= r;
+  }
+}
+
+static void* gzip_writer(void* arg) {
+  struct zw* z = arg;
+  char* out = z_alloc(ZQ_SIZE);
+  z_stream s;
+  memset(&s, 0, sizeof(s));
+  if(deflateInit2(&s, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+		  Z_DEFAULT_STRATEGY) != Z_OK) { // with a gzip header
+    z_fatal("cannot start gzip", s.msg ? s.msg : "deflateInit");
+  }
+  struct zbuf* b;
+  int flush;
+  do {
+    b = zq_take(&z->q);
+    s.next_in = (Bytef*) (b ? b->p : out);
+    s.avail_in = b ? b->n : 0;
+    flush = b == NULL ? Z_FINISH : b->sync ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+    do {
+      s.next_out = (Bytef*) out;
+      s.avail_out = ZQ_SIZE;
+      deflate(&s, flush);
+      z_out(z, out, ZQ_SIZE - s.avail_out);
+    } while(s.avail_out == 0);
+    if(b != NULL) {
+      zq_release(&z->q);
+    }
+  } while(b != NULL);
+  deflateEnd(&s);
+  free(out);
+  return NULL;
+}
+
+#ifdef HAVE_ZSTD
+static void* zstd_writer(void* arg) {
+  struct zw* z = arg;
+  char* out = z_alloc(ZQ_SIZE);
+  ZSTD_CCtx* cs = ZSTD_createCCtx();
+  struct zbuf* b;
+  do {
+    b = zq_take(&z->q);
+    ZSTD_inBuffer ib = { b ? b->p : out, b ? b->n : 0, 0 };
+    ZSTD_EndDirective mode = b == NULL ? ZSTD_e_end :
+      b->sync ? ZSTD_e_flush : ZSTD_e_continue;
+    size_t left;
+    do {
+      ZSTD_outBuffer ob = { out, ZQ_SIZE, 0 };
+      left = ZSTD_compressStream2(cs, &ob, &ib, mode);
+      if(ZSTD_isError(left)) {
+	z_fatal("zstd compression failed", ZSTD_getErrorName(left));
+      }
+      z_out(z, out, ob.pos);
+    } while(mode == ZSTD_e_continue ? ib.pos < ib.size : left != 0);
+    if(b != NULL) {
+      zq_release(&z->q);
+    }
+  } while(b != NULL);
+  ZSTD_freeCCtx(cs);
+  free(out);
+  return NULL;
+}
+#endif
+
+struct zw* z_write_open(int fd, int codec) {
+  struct zw* z = z_alloc(sizeof(*z));
+  memset(z, 0, sizeof(*z));
+  z->fd = fd;
+  z->codec = codec;
+  void* (*writer)(void*) = gzip_writer;
+#ifdef HAVE_ZSTD
+  if(codec == Z_ZSTD) {
+    writer = zstd_writer;
+  }
+#else
+  if(codec == Z_ZSTD) {
+    z_fatal("cannot write zstd output", "built without HAVE_ZSTD");
+  }
+#endif
+  zq_init(&z->q);
+  if(pthread_create(&z->tid, NULL, writer, z) != 0) {
+    z_fatal("cannot start compression thread", strerror(errno));
+  }
+  return z;
+}
+
+void z_write(struct zw* z, const char* p, size_t n, bool sync) {
+  while(n > 0 || sync) {
+    if(z->fill == NULL) {
+      z->fill = zq_empty(&z->q);
+    }
+    size_t k = ZQ_SIZE - z->fill->n;
+    k = k < n ? k : n;
+    memcpy(z->fill->p + z->fill->n, p, k);
+    z->fill->n += k;
+    p += k;
+    n -= k;
+    if(z->fill->n == ZQ_SIZE || (n == 0 && sync)) {
+      z->fill->sync = sync && n == 0;
+      zq_put(&z->q);
+      z->fill = NULL;
+      if(n == 0) {
+	break;
+      }
+    }
+  }
+}
+
+void z_write_close(struct zw* z) {
+  if(z->fill != NULL && z->fill->n > 0) {
+    zq_put(&z->q);
+  }
+  zq_set(&z->q, &z->q.done);
+  pthread_join(z->tid, NULL);
+  zq_free(&z->q);
+  free(z);
+}
+
+#ifdef TEST
+// gzip a million lines then check they read back
+int main() {
+  char tmpl[] = "/tmp/tst-zXXXXXX";
+  int fd = mkstemp(tmpl);
+  struct zw* w = z_write_open(fd, Z_GZIP);
+  long n = 0, i;
+  char line[64];
+  for(i = 0; i < 1000000; i++) {
+    int k = snprintf(line, sizeof(line), "%ld,%ld\n", i, i * i);
+    z_write(w, line, k, i % 100000 == 0);
+    n += k;
+  }
+  z_write_close(w);
+  off_t size = lseek(fd, 0, SEEK_END);
+  lseek(fd, 0, SEEK_SET);
+  unsigned char magic[4];
+  ssize_t m = read(fd, magic, 4);
+  FILE* fp = z_read(fd, z_codec(magic, m), (char*) magic, m);
+  char* s = NULL;
+  size_t len = 0;
+  long bad = 0, got = 0;
+  for(i = 0; getline(&s, &len, fp) > 0; i++) {
+    snprintf(line, sizeof(line), "%ld,%ld\n", i, i * i);
+    bad += strcmp(s, line) != 0;
+    got += strlen(s);
+  }
+  fclose(fp);
+  free(s);
+  remove(tmpl);
+  printf("%ld bytes in %ld gzip'd, %ld lines %ld bad\n",
+	 n, (long) size, i, bad);
+  return bad != 0 || got != n;
+}
+#endif
@@ -0,0 +1,61 @@
+/*
+ * tst-z.h - gzip/zstd compressed input and output
+ *
+ *
+ * Copyright (c) 2015, Phil Maker
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TST_Z_H_
+#define _TST_Z_H_ 1
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// The codec runs on a thread of its own and talks to us through a
+// small queue of large buffers, so (de)compression overlaps with
+// parsing and formatting instead of taking turns with it.  zstd is
+// only there if built with HAVE_ZSTD.
+
+enum { Z_PLAIN, Z_GZIP, Z_ZSTD };
+
+int z_codec(const unsigned char* p, size_t n); // from the magic number
+int z_codec_name(char* name); // none|gzip|zstd or -1
+
+// z_read - a stream of fd decompressed with codec, prefix[0..n-1]
+//   (n <= 8) are the bytes already read from fd to find the codec.
+FILE* z_read(int fd, int codec, const char* prefix, size_t n);
+
+struct zw;
+struct zw* z_write_open(int fd, int codec);
+// z_write - queue p[0..n-1] to be compressed, with sync what has
+//   been written so far can be decompressed at the other end.
+void z_write(struct zw* z, const char* p, size_t n, bool sync);
+void z_write_close(struct zw* z); // finish the stream and wait for it
+
+#endif /* _TST_Z_H_ */
@@ -34,10 +34,30 @@
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <math.h>
 
 #include "options.h"
 #include "tst-split.h"
 #include "tst-t.h"
+#include "tst-tz.h"
+#include "tst-read.h"
+#include "tst-write.h"
+#include "tst-num.h"
+#include "tst-bin.h"
+#include "tst-arrow.h"
+#include "tst-index.h"
+#include "tst-z.h"
+#include "tst-agg.h"
+#include "tst-stream.h"
+#include "tst-stats.h"
 
 // global options which are settable via
 // command line
@@ -48,31 +68,119 @@ double dv;
 double zdb;
 tms st;
 tms et;
+double vmin;
+double vmax;
 char* vfmt;
+bool vfmt_g; // -vfmt is %g
+bool vfmt_shortest; // -vfmt is shortest
 char* sep;
+char isep;
 char* recsep;
 bool show_parsed_t;
 bool show_parsed_v;
 bool show_input; 
 tms every;
 char* topt;
+char* tz;
+char* tfmt; // -tfmt user time format
+char* flush;
+long jobs;
+long threads;
+char* inopt;
+char* outopt;
+bool out_bin; // -out bin
+bool out_arrow; // -out arrow or arrows
+bool out_csv; // neither, so # lines can go in the output
+char* index_opt;
+bool index_use; // -index 1 or build
+bool index_only; // -index build
+char* compress;
+char* aggopt;
+int nagg; // -agg aggregates or 0 for sample and hold
+int aggk[AGG_N]; // which ones
+tms iunit; // time unit for -agg integral
+bool merge; // -merge the files into one stream
+bool asof; // -asof join the files into wide rows
+double sdev; // -sd swinging door deviation, 0 for -dv instead
+tms sdmax; // -sd_max longest gap between kept rows
+bool follow; // -follow the file as it grows
+char* checkpoint; // -checkpoint file for -follow or ""
+static struct tst_opts topts; // all of the above that shape the rows
+char* stats_opt;
+bool stats; // -stats to stderr when we're done
+
+// -stats counts, per thread and added up in sts_all as threads finish
+struct stats {
+  unsigned long cyc[ST_N]; // cycles in each stage
+  long bad; // rows with a bad time or value
+  struct parse_t_counts pt;
+};
+static __thread struct stats sts;
+static struct stats sts_all;
+static long bytes_in;
+
+// a run's totals, which is also what a -jobs child hands back
+struct stats_total {
+  struct stats s;
+  struct tst_counts n;
+  long bytes_in;
+};
 
 static void process(char* filename); // process an input file
+static void finish_output(); // after the last file
+static void write_exit(); // the samples still waiting at exit
+static void process_jobs(); // process the files jobs at a time
+static void process_merge(); // -merge or -asof the files
+static void process_follow(); // -follow the file
+static void stats_start();
+static void stats_report();
+static void stats_send(int fd); // a -jobs child's totals
+static void stats_recv(int fd); // added to ours
+static void stats_fork(); // a -jobs child counts only its own file
 
 int main(int argc, char** argv) {
   init_options(argc, argv);
   // show_options();
 
+  // the options are printed as they're read but they belong in the
+  // output, so hold them until we know how to write it (-compress)
+  char* opts;
+  size_t optslen;
+  FILE* out = stdout;
+  bool held = (stdout = open_memstream(&opts, &optslen)) != NULL;
+  if(!held) {
+    stdout = out;
+  }
+
   // grab all the options
   help = option_bool("-help", "1", "What is it?");
   meta_add = option_bool("-meta_add", "0", "What is it?");
   meta_strip = option_bool("-meta_strip", "1", "What is it?"); 
   dv = option_double("-dv", "0", "What is it?");
   zdb = option_double("-zdb", "0", "What is it?");
+  sdev = option_double("-sd", "0",
+		       "swinging door deviation, used instead of -dv/-zdb");
+  sdmax = option_period("-sd_max", "0",
+			"with -sd keep a row at least this often");
+  tz = option("-tz", "UTC",
+	      "zone for times without an offset (in and -t %...), "
+	      "e.g. Australia/Sydney");
+  if(!tz_load(tz)) {
+    fprintf(stderr, "%s: fatal unknown time zone -tz %s\n",
+	    get_progname(), tz);
+    exit(123);
+  }
   st = option_time("-st", "1970-1-1", "What is it?");
   et = option_time("-et", "3000-1-1", "What is it?");
-  vfmt = option("-vfmt", "%g", "What is it?");  
+  vmin = option_double("-vmin", "-inf",
+		       "only write rows with a value >= vmin");
+  vmax = option_double("-vmax", "inf",
+		       "only write rows with a value <= vmax");
+  vfmt = option("-vfmt", "%g", "printf format for values or shortest");  
+  vfmt_g = strcmp(vfmt, "%g") == 0;
+  vfmt_shortest = strcmp(vfmt, "shortest") == 0;
   sep = option("-sep", ",", "What is it?");
+  isep = option("-isep", ",", "input field separator, -sep is for output")[0];
   recsep = option("-recsep", "\n", "What is it?");
 
   show_input = option_bool("-show_input", "0", "What is it?");
@@ -80,135 +188,577 @@ int main(int argc, char** argv) {
   show_parsed_v = option_bool("-show_parsed_v", "0", "What is it?");
 
   every = option_period("-every", "0", "What is it?");
+  aggopt = option("-agg", "hold",
+		  "hold|mean,min,max,first,last,count,twa,integral per -every");
+  iunit = option_period("-iunit", "1s", "time unit for -agg integral");
+  merge = option_bool("-merge", "0",
+		      "merge the files into one time ordered stream");
+  asof = option_bool("-asof", "0",
+		     "join the files into a wide row per time, "
+		     "each file's latest values");
 
   topt = option("-t", "iso", 
 	     "iso|10m|%Y/%M/...");
+  tfmt = option("-tfmt", "",
+		"strptime format for input times, tried before the others");
+  parse_t_lock = option_long("-tlock", "0",
+			     "only try a file's time format once N rows "
+			     "match it, 0 never");
 
+  flush = option("-flush", "auto",
+		 "auto|size|line|500ms... when to write output");
+
+  jobs = option_long("-jobs", "1",
+		     "process up to N files at once each on its own");
+  threads = option_long("-threads", "1",
+			"parse each file with N threads");
+
+  inopt = option("-in", "auto", "auto|csv|bin input format");
+  outopt = option("-out", "csv",
+		  "csv|bin|arrow|arrows output format, arrow(s) is the "
+		  "Arrow IPC file (stream) format");
+  out_bin = strcmp(outopt, "bin") == 0;
+  out_arrow = strcmp(outopt, "arrow") == 0 || strcmp(outopt, "arrows") == 0;
+  out_csv = !out_bin && !out_arrow;
+  index_opt = option("-index", "0",
+		     "0|1|build use (and build) file.csv.tsx to seek to -st");
+  index_only = strcmp(index_opt, "build") == 0;
+  index_use = index_only || atoi(index_opt) != 0;
+  compress = option("-compress", "none",
+		    "none|gzip|zstd compress the output");
+  stats_opt = option("-stats", "0",
+		     "0|1|json time each stage and count rows to stderr");
+  stats = strcmp(stats_opt, "0") != 0;
+  follow = option_bool("-follow", "0",
+		       "keep reading the file as it grows, until killed");
+  checkpoint = option("-checkpoint", "",
+		      "with -follow keep the offset and state here "
+		      "and resume from it");
+
+  if(held) {
+    fclose(stdout);
+    stdout = out;
+  }
   if(help) { // we've printed the help message so exit
+    if(held) {
+      fwrite(opts, 1, optslen, stdout);
+    }
     exit(0);
   }
+  if(strcmp(aggopt, "hold") != 0 &&
+     ((nagg = agg_parse(aggopt, aggk)) <= 0 || every <= 0 || iunit <= 0)) {
+    fprintf(stderr, "%s: fatal -agg %s needs known aggregates and -every\n",
+	    get_progname(), aggopt);
+    exit(116);
+  }
+  if(tfmt[0] != '\0' && !parse_t_format(tfmt)) {
+    fprintf(stderr, "%s: fatal too many time formats for -tfmt %s\n",
+	    get_progname(), tfmt);
+    exit(122);
+  }
+  if(merge || asof) { // the files take turns so no one format
+    parse_t_lock = 0;
+  }
+  if(z_codec_name(compress) < 0) {
+    fprintf(stderr, "%s: fatal unknown -compress %s\n",
+	    get_progname(), compress);
+    exit(114);
+  }
+  tst_opts_init(&topts);
+  topts.st = st;
+  topts.et = et;
+  topts.vmin = vmin;
+  topts.vmax = vmax;
+  topts.dv = dv;
+  topts.zdb = zdb;
+  topts.sdev = sdev;
+  topts.sdmax = sdmax;
+  topts.every = every;
+  topts.nagg = nagg;
+  memcpy(topts.aggk, aggk, sizeof(aggk));
+  topts.iunit = iunit;
+  topts.isep = isep;
+  topts.sep = sep;
+  topts.recsep = recsep;
+  topts.vfmt = vfmt;
+  topts.topt = topt;
+  topts.meta_strip = meta_strip;
+
+  wr_init(1, flush);
+  atexit(write_exit); // runs before wr_init's flush
+  wr_compress(z_codec_name(compress));
+  if(stats) {
+    stats_start();
+  }
+  if(held) { // no room for them in arrow
+    if(!out_arrow) {
+      wr_mem(opts, optslen);
+    }
+    free(opts);
+  }
     
   // add the command line
-  if(meta_add) {
-    printf("# %%");
+  if(meta_add && out_csv) {
+    wr_str("# %");
     for(int i = 0; i < argc; i++) {
-      printf(" %s", argv[i]);
+      wr_char(' ');
+      wr_str(argv[i]);
     }
-    printf("\n");
+    wr_char('\n');
   }
 
   // process the files
   if(get_filename(0) == NULL) {
     process("-");
+  } else if(follow) {
+    process_follow();
+  } else if(merge || asof) {
+    process_merge();
+  } else if(jobs > 1 && get_filename(1) != NULL && !out_arrow) {
+    // arrow streams can't just be joined up so -jobs is ignored
+    process_jobs();
   } else {
     for(int i = 0; get_filename(i) != NULL; i++) {
       process(get_filename(i));
     }
   }
+  finish_output();
+  if(stats) {
+    stats_report();
+  }
 
   return 0;
 }
 
-// open infp using filename or stdin if its "-"
-static FILE* infp;
+// open in using filename or stdin if its "-"
+static struct rd* in;
+static char* inname;
 
 static void open_filename(char* filename) {
-  if(strcmp(filename,"-") == 0) {
-    infp = stdin;
-  } else {
-    errno = 0;
-    if((infp = fopen(filename, "r")) == NULL) {
-      fprintf(stderr, "%s: fatal error cannot open file \"%s\": %s\n", 
-	      get_progname(), 
-	      filename,
-	      strerror(errno));
-      exit(103);
-    }
+  inname = filename;
+  parse_t_reset(); // each file finds its own time format
+  errno = 0;
+  if((in = rd_open(filename)) == NULL) {
+    fprintf(stderr, "%s: fatal error cannot open file \"%s\": %s\n", 
+	    get_progname(), 
+	    filename,
+	    strerror(errno));
+    exit(103);
   }
 }
 
-// read line from infp stripping out 
+// read line from in stripping out 
 //  meta_data if -meta_strip
 //  empty lines
-//  finally trim the trailing \n 
-static char line[1024];
+// the trailing \n is already gone and there is no limit
+// on the line length.
+static char* line;
+static size_t linelen;
+static size_t lineoff; // where line starts in the file
+static volatile sig_atomic_t stopping; // -follow was asked to stop
+
+static void follow_wait(); // -follow: for the file to grow
 
 static char* readline() {
   for(;;) {
-    if(fgets(line, sizeof(line), infp) == NULL) {
-      return NULL;
+    lineoff = rd_tell(in);
+    if(follow && stopping) { // finish on a line boundary
+      follow_wait();
+    }
+    unsigned long c0 = stats ? stats_clock() : 0;
+    line = rd_line(in, &linelen);
+    if(stats) {
+      sts.cyc[ST_READ] += stats_clock() - c0;
+    }
+    if(line == NULL) {
+      if(!follow) {
+	return NULL;
+      }
+      follow_wait();
     } else {
       if(show_input) {
-	printf("# line %s", line);
+	wr_printf("# line %s\n", line);
       }
       if(meta_strip && line[0] == '#') {
 	// strip out meta_data from input
-      } else if(line[0] == '\n') { 
+      } else if(linelen == 0) { 
 	// strip out empty lines
-      } else { // got it, just remove \n
-	line[strlen(line)-1] = '\0';
+      } else { // got it
 	return line;
       }
     }
   }
 }
-
-// read the header line
+
+// the fields of the current line
+static struct fields fs;
+
+// read the header line, t,v1,v2,... with any number of
+// value columns but every file must have the same number
 
 static char* tlabel;
-static char* vlabel;
+static char** vlabels; // vlabels[0..nv-1]
+static int nv; // number of value columns
+static char** olabels; // olabels[0..onv-1]
+static int onv; // number of value columns written, nv * nagg with -agg
 static bool  read_delta;
 static tms   read_tsize;
 
+tms write_tsize;
+bool write_delta;
+
+static void alloc_values(int n);
+
+// set_values - the value labels are labels[0..n-1], and the time
+//   is read_delta/read_tsize
+static void set_values(int n, char** labels) {
+  if(nv != 0 && n != nv) {
+    fprintf(stderr, "oops header has %d values but expected %d\n",
+	    n, nv);
+    exit(98);
+  }
+  if(nv == 0) {
+    alloc_values(n);
+  }
+  int i;
+  for(i = 0; i < nv; i++) {
+    free(vlabels[i]);
+    vlabels[i] = strdup(labels[i]);
+  }
+  for(i = 0; nagg > 0 && i < onv; i++) { // label_mean, label_max ...
+    char* l = vlabels[i / nagg];
+    char* a = agg_name(aggk[i % nagg]);
+    free(olabels[i]);
+    if((olabels[i] = malloc(strlen(l) + strlen(a) + 2)) == NULL) {
+      fprintf(stderr, "oops: out of memory for %d columns\n", onv);
+      exit(12);
+    }
+    sprintf(olabels[i], "%s_%s", l, a);
+  }
+  // unless told otherwise write time the way we read it
+  write_delta = read_delta;
+  write_tsize = read_tsize;
+}
+
 void read_header() { 
   if(readline()) { 
-    if(split_csv(line) != 2) { 
-      fprintf(stderr, "oops must have two fields in header\n");
+    int n = split_fields(&fs, line, linelen, isep);
+    if(n < 2) { 
+      fprintf(stderr, "oops must have at least two fields in header\n");
       exit(99);
     }
-    tlabel = strdup(field(0));
+    tlabel = strdup(fs.f[0]);
     if(!parse_t_header(tlabel, &read_delta, &read_tsize)) {
       fprintf(stderr, "failed to parse tlabel %s\n", tlabel);
       exit(100);
     }
-    vlabel = strdup(field(1));
+    set_values(n - 1, fs.f + 1);
   } else {
     fprintf(stderr, "oops: no header\n");
     exit(11);
   }
 }
 
-void write_output(tms t, double v);
+void write_output(tms t, double* v);
+void write_flush();
+static void pipe_block(int n, tms* t, double* v);
 void write_header();
 
 bool show_parsed_t;
 bool show_parsed_v;
+
+static double* rv; // values read from the current line
+
+// parse_row - split s into f and parse its time (before any delta
+//   decoding) into *t and its n values (labels[0..n-1]) into
+//   v[0..n-1], false if the line should be skipped.
+static bool parse_row(struct fields* f, char* s, size_t len,
+		      int n, tms tsize, char** labels, tms* t, double* v) {
+  unsigned long c0 = stats ? stats_clock() : 0, c1 = 0, c2 = 0;
+  if(split_fields(f, s, len, isep) != n + 1) {
+    fprintf(stderr, "wrong number of fields\n");
+    exit(90);
+  }
+
+  if(stats) {
+    c1 = stats_clock();
+  }
+  *t = parse_t_len(f->f[0], f->f[1] - f->f[0] - 1);
+  if(stats) {
+    c2 = stats_clock();
+    sts.cyc[ST_SPLIT] += c1 - c0;
+    sts.cyc[ST_TIME] += c2 - c1;
+  }
+  if(!ISTIME(*t)) {
+    fprintf(stderr, "%s: bad time \"%s\" ignored\n",
+	    get_progname(), f->f[0]);
+    sts.bad++;
+    return false;
+  }
+  if(parse_t_numeric()) { // in header units not ms
+    *t *= tsize;
+  }
+  int i;
+  for(i = 0; i < n; i++) {
+    if(!parse_v(f->f[i + 1], &v[i])) {
+      fprintf(stderr, "%s: bad value \"%s\" for %s at %s ignored\n",
+	      get_progname(), f->f[i + 1], labels[i], f->f[0]);
+      sts.bad++;
+      return false;
+    }
+  }
+  if(stats) {
+    sts.cyc[ST_VALUE] += stats_clock() - c2;
+  }
+  return true;
+}
+
+// parse_line - parse_row for the file being read
+static bool parse_line(struct fields* f, char* s, size_t len,
+		       tms* t, double* v) {
+  return parse_row(f, s, len, nv, read_tsize, vlabels, t, v);
+}
+
+// -threads N: the rest of a mapped file is cut into line aligned
+// chunks which are parsed on N threads into batches of t and v
+// then handed to write_output in order, the order dependent work
+// (-every, -dv ...) is all done there.  Delta times are summed in
+// each chunk and then only need the time before the chunk added.
+
+#define BATCH_BYTES (4 * 1024 * 1024) // bytes per chunk
+
+struct batch {
+  char* s; // the chunk of lines, read only in the map
+  size_t len;
+  char* buf; // a copy of them to split in place
+  size_t bufsz;
+  struct fields fs;
+  int n; // rows parsed
+  int size; // allocated rows
+  tms* t; // t[0..n-1]
+  double* v; // v[0..n*nv-1] row by row
+};
+
+static void stats_add(struct stats* s);
+
+static void* parse_batch(void* arg) {
+  struct batch* b = arg;
+  if(b->len + 1 > b->bufsz) {
+    b->bufsz = b->len + 1;
+    if((b->buf = realloc(b->buf, b->bufsz)) == NULL) {
+      fprintf(stderr, "oops: out of memory for batch\n");
+      exit(13);
+    }
+  }
+  memcpy(b->buf, b->s, b->len);
+  char* p = b->buf;
+  char* end = b->buf + b->len;
+  b->n = 0;
+  while(p < end) {
+    char* s = p;
+    char* nl = memchr(p, '\n', end - p);
+    if(nl == NULL) { // the last line of the file, buf has room
+      nl = end;
+    }
+    *nl = '\0';
+    p = nl + 1;
+    if((meta_strip && s[0] == '#') || nl == s) {
+      continue;
+    }
+    if(b->n == b->size) {
+      b->size = b->size == 0 ? 4096 : b->size * 2;
+      b->t = realloc(b->t, b->size * sizeof(tms));
+      b->v = realloc(b->v, b->size * nv * sizeof(double));
+      if(b->t == NULL || b->v == NULL) {
+	fprintf(stderr, "oops: out of memory for batch\n");
+	exit(13);
+      }
+    }
+    if(parse_line(&b->fs, s, nl - s, &b->t[b->n], &b->v[b->n * nv])) {
+      b->n++;
+    }
+  }
+  int i;
+  for(i = 1; read_delta && i < b->n; i++) { // relative to the chunk
+    b->t[i] += b->t[i - 1];
+  }
+  if(stats) { // this thread's share
+    stats_add(&sts);
+  }
+  return NULL;
+}
+
+// read_et - rows after the first one past this can't change the
+//   output, -agg needs all of the bucket that starts at or before et
+static tms read_et() {
+  return nagg > 0 ? et + every : et;
+}
+
+// read_batches - true if it stopped early because it got past et
+//   and stop_et says the rest of the file is later still
+static bool read_batches(tms* old_t, bool stop_et) {
+  static struct batch* bs;
+  pthread_t* tids = calloc(threads, sizeof(pthread_t));
+  if(bs == NULL) {
+    bs = calloc(threads, sizeof(struct batch));
+  }
+  if(bs == NULL || tids == NULL) {
+    fprintf(stderr, "oops: out of memory for threads\n");
+    exit(13);
+  }
+  for(;;) {
+    int k, n;
+    for(n = 0; n < threads; n++) {
+      if((bs[n].s = rd_chunk(in, BATCH_BYTES, &bs[n].len)) == NULL) {
+	break;
+      }
+    }
+    if(n == 0) {
+      break;
+    }
+    for(k = 1; k < n; k++) {
+      if(pthread_create(&tids[k], NULL, parse_batch, &bs[k]) != 0) {
+	parse_batch(&bs[k]); // do it ourselves
+	tids[k] = 0;
+      }
+    }
+    parse_batch(&bs[0]);
+    for(k = 1; k < n; k++) {
+      if(tids[k] != 0) {
+	pthread_join(tids[k], NULL);
+      }
+    }
+    for(k = 0; k < n; k++) { // stitch them back together
+      int i;
+      tms base = read_delta ? *old_t : 0;
+      for(i = 0; i < bs[k].n; i++) {
+	tms t = bs[k].t[i] + base;
+	write_output(t, &bs[k].v[i * nv]);
+	if(stop_et && t > read_et()) {
+	  if(read_delta) {
+	    *old_t = t;
+	  }
+	  write_flush();
+	  free(tids);
+	  return true;
+	}
+      }
+      if(read_delta && bs[k].n > 0) {
+	*old_t = bs[k].t[bs[k].n - 1] + base;
+      }
+    }
+    write_flush(); // nothing waits while the next chunks are parsed
+  }
+  free(tids);
+  return false;
+}
  
-void read_input() { 
-  read_header();
+// read_bin_input - in is in the binary format
+static void read_bin_input() {
+  struct bin_r* r = bin_r_open(in);
+  struct bin_hdr* h = bin_r_hdr(r);
+  read_delta = h->delta;
+  read_tsize = h->tsize;
+  set_values(h->nv, h->vlabels);
   write_header();
-  while(readline()) { 
-    if(split_csv(line) != 2) {
-      fprintf(stderr, "wrong number of fields\n");
-      exit(90);
+  if(!show_parsed_t) { // use the index to skip blocks we don't need
+    bin_r_select(r, st, read_et(), vmin, vmax, every != 0);
+  }
+  int n;
+  tms* t;
+  double* v;
+  for(;;) {
+    unsigned long c0 = stats ? stats_clock() : 0;
+    if((n = bin_r_block(r, &t, &v)) <= 0) {
+      break;
+    }
+    if(stats) {
+      sts.cyc[ST_READ] += stats_clock() - c0;
+    }
+    if(!show_parsed_t) { // already column by column
+      pipe_block(n, t, v);
+      continue;
+    }
+    int i, c;
+    for(i = 0; i < n; i++) {
+      for(c = 0; c < nv; c++) {
+	rv[c] = v[c * n + i];
+      }
+      wr_printf("* t = %ld = %s\n", t[i], fmt_t(t[i]));
+      write_output(t[i], rv);
     }
+  }
+  bin_r_close(r);
+}
 
-    tms t = parse_t(field(0)) * read_tsize;
+static tms old_t; // last time for delta encoded input
+static bool follow_resume();
+
+void read_input() { 
+  if(strcmp(inopt, "bin") == 0 ||
+     (strcmp(inopt, "auto") == 0 && bin_is(in))) {
+    read_bin_input();
+    return;
+  }
+  read_header();
+  if(follow && follow_resume()) { // the header is already written
+  } else if(!index_only) {
+    write_header();
+  }
+  struct tsx* x = NULL;
+  bool stop = false; // past -et in a sorted file
+  if(index_use && (x = tsx_open(inname, in)) != NULL) {
+    size_t off;
+    if(index_only) { // just index what's been appended
+      if(x->end > 0) {
+	rd_seek(in, x->end);
+	old_t = x->last_t;
+      }
+      stop = x->fresh;
+    } else if(tsx_seek(x, st, &off, &old_t)) {
+      rd_seek(in, off);
+    }
+  }
+  if(threads > 1 && !show_input && !show_parsed_t && !show_parsed_v &&
+     !stop && (x == NULL || x->fresh)) {
+    // leaves anything it can't do for readline
+    stop = read_batches(&old_t, x != NULL && x->sorted);
+  }
+  while(!stop && readline()) { 
+    tms t;
+    if(!parse_line(&fs, line, linelen, &t, rv)) {
+      continue;
+    }
+    if(x != NULL) {
+      tsx_row(x, lineoff, read_delta ? t + old_t : t, read_delta ? old_t : 0);
+    }
     if(read_delta) {
-      static tms old_t = 0;
       t = t + old_t;
+      old_t = t;
+    }
+    if(index_only) {
+      continue;
     }
-    double v = strtod(field(1), NULL);
     
     if(show_parsed_t) {
-      printf("* t = %ld = ", t);
-      print_t(t);
-      printf("\n");
+      wr_printf("* t = %ld = %s\n", t, fmt_t(t));
     }
     if(show_parsed_v) { 
-      printf("* v = %g\n", v);
+      wr_str("* v =");
+      int i;
+      for(i = 0; i < nv; i++) {
+	wr_printf(" %g", rv[i]);
+      }
+      wr_char('\n');
     }
-    write_output(t, v);
+    write_output(t, rv);
+    if(x != NULL && t > read_et() && x->sorted && lineoff < x->end) {
+      stop = true; // the index says the rest is later still
+    }
+  }
+  write_flush();
+  if(x != NULL) {
+    tsx_close(x, !stop);
   }
 }
 
@@ -220,120 +770,798 @@ char* recsep; // record separator
 tms write_tsize; // step size for t in ms
 bool write_delta; // delta encoded time
 
+static struct tst_stream* ts; // the rows on their way out
+static struct bin_w* bw; // -out bin writer
+static struct arrow_w* aw; // -out arrow writer
+
 void write_header() {
-  printf("%s,%s\n", 
-	 unparse_t_header(write_delta, write_tsize), 
-	 vlabel);
+  if(out_bin) { // one header for all the files
+    if(bw == NULL) {
+      struct bin_hdr h = { write_delta, write_tsize, onv, olabels };
+      bw = bin_w_open(&h);
+    }
+    return;
+  }
+  if(out_arrow) { // likewise, times are always ms in arrow
+    if(aw == NULL) { // arrow only knows zones by name, UTC for a rule
+      aw = arrow_w_open(strcmp(outopt, "arrow") == 0,
+			tz_olson() != NULL ? tz_olson() : "UTC", onv, olabels);
+    }
+    return;
+  }
+  wr_str(unparse_t_header(write_delta, write_tsize));
+  int i;
+  for(i = 0; i < onv; i++) {
+    wr_str(sep);
+    wr_str(olabels[i]);
+  }
+  wr_char('\n');
 }
 
 tms every; // every t ms show a sample if not 0
 
-void write_output1(tms t, double v);
-void write_every(tms t, double v);
+static void write_block(void* arg, int n, tms* t, double* v);
+
+// samples go down the pipeline BLOCK_ROWS at a time, column by
+// column, see tst_block
+#define BLOCK_ROWS 4096
+
+static tms* bt; // bt[0..bn-1] are waiting
+static double* bv; // with value c of sample i in bv[c * BLOCK_ROWS + i]
+static int bn;
+static double* wv; // a row for -out bin
 
-static tms ot = 0;
-static double ov = 0;
+// alloc_values - set up the per column state for n values
+static void alloc_values(int n) {
+  nv = n;
+  if((ts = tst_open(&topts, n)) != NULL) {
+    tst_emit_block(ts, write_block, NULL);
+    onv = tst_nout(ts);
+  }
+  vlabels = calloc(n, sizeof(char*));
+  olabels = nagg > 0 ? calloc(onv, sizeof(char*)) : vlabels;
+  rv = calloc(n, sizeof(double));
+  bt = calloc(BLOCK_ROWS, sizeof(tms));
+  bv = calloc((size_t) BLOCK_ROWS * n, sizeof(double));
+  wv = calloc(onv, sizeof(double));
+  if(ts == NULL || vlabels == NULL || olabels == NULL || rv == NULL ||
+     bt == NULL || bv == NULL || wv == NULL) {
+    fprintf(stderr, "oops: out of memory for %d columns\n", n);
+    exit(12);
+  }
+}
 
-// write_output t v - 
-void write_output(tms t, double v) {
-  if(every == 0) { // not resampling the data
-    write_output1(t, v); // so send it straight off
+// pipe_block - n samples down the pipeline in one go
+static void pipe_block(int n, tms* t, double* v) {
+  if(stats) {
+    unsigned long c0 = stats_clock();
+    tst_block(ts, n, t, v);
+    sts.cyc[ST_PIPE] += stats_clock() - c0;
   } else {
-    write_every(t, v);
+    tst_block(ts, n, t, v);
+  }
+}
+
+// write_output t v - send it down the pipeline, it waits with the
+//   next few thousand (unless we're showing what's read) and the
+//   rows that come out go to write_block
+void write_output(tms t, double* v) {
+  bt[bn] = t;
+  int c;
+  for(c = 0; c < nv; c++) {
+    bv[c * BLOCK_ROWS + bn] = v[c];
+  }
+  if(++bn == BLOCK_ROWS || show_input || show_parsed_t || show_parsed_v) {
+    write_flush();
   }
-  ot = t;
-  ov = v;
 }
 
-tms next_every(tms t) {
-  return ((t / every) + 1) * every;
+// write_flush - the samples waiting in bt/bv down the pipeline
+void write_flush() {
+  int n = bn, c;
+  if(n == 0) {
+    return;
+  }
+  for(c = 1; n < BLOCK_ROWS && c < nv; c++) { // close up the columns
+    memmove(bv + c * n, bv + c * BLOCK_ROWS, n * sizeof(double));
+  }
+  bn = 0;
+  pipe_block(n, bt, bv);
 }
 
-static bool first = true;
+static void write_exit() {
+  if(ts != NULL) {
+    write_flush();
+  }
+}
 
-// write_every every ms t,v so
-// collect samples until the last one before 
-// a value that rounds 
-void write_every(tms t, double v) { 
-  if(first) {
-    if((t % every) == 0) {
-      write_output1(t,v);
+static tms tb; // the last time written for -t delta output
+
+// write_block - rows t[0..n-1] with value c of row i in v[c * n + i],
+//   how they're written is only worked out once
+static void write_block(void* arg, int n, tms* t, double* v) {
+  int i, c;
+  if(out_arrow) { // already column by column
+    arrow_w_rows(aw, n, t, v);
+    return;
+  }
+  if(out_bin) {
+    for(i = 0; i < n; i++) {
+      for(c = 0; c < onv; c++) {
+	wv[c] = v[c * n + i];
+      }
+      bin_w_row(bw, t[i], wv);
     }
-    first = false;
-  } else {
-    while((ot = next_every(ot)) < t) {
-      write_output1(ot, ov);
+    return;
+  }
+
+  int tk = strcmp(topt, "iso") == 0 ? 0 : topt[0] == '%' ? 1 : 2;
+  int vk = vfmt_g ? 0 : vfmt_shortest ? 1 : 2;
+  size_t seplen = strlen(sep), recseplen = strlen(recsep);
+  for(i = 0; i < n; i++) {
+    if(tk == 0) { // ttt speed
+      wr_t(t[i]);
+    } else if(tk == 1) {
+      wr_str(fmt_tg(t[i], topt));
+    } else if(write_delta) {
+      wr_long((t[i] - tb) / write_tsize);
+    } else {
+      wr_long(t[i] / write_tsize);
+    }
+    tb = t[i];
+    for(c = 0; c < onv; c++) {
+      double x = v[c * n + i];
+      wr_mem(sep, seplen);
+      if(vk == 0) {
+	wr_commit(fmt_g(x, wr_reserve(FMT_V_SIZE)));
+      } else if(vk == 1) {
+	wr_commit(fmt_shortest(x, wr_reserve(FMT_V_SIZE)));
+      } else {
+	wr_printf(vfmt, x);
+      }
+    }
+    wr_mem(recsep, recseplen);
+    wr_endrec();
+  }
+}
+
+static struct tst_counts counts; // of the pipelines before ts
+
+static void counts_add(struct tst_counts* to, struct tst_counts* n) {
+  to->samples += n->samples;
+  to->rows += n->rows;
+  to->trange += n->trange;
+  to->vrange += n->vrange;
+  to->unchanged += n->unchanged;
+  to->out += n->out;
+}
+
+// end_file - the last -agg bucket or -sd row of the file before goes
+//   out and the next one starts with a fresh pipeline just like it
+//   would in a -jobs child
+static void end_file() {
+  write_flush();
+  tst_end(ts);
+  counts_add(&counts, tst_counts(ts));
+  tst_close(ts);
+  if((ts = tst_open(&topts, nv)) == NULL) {
+    fprintf(stderr, "oops: out of memory for %d columns\n", nv);
+    exit(12);
+  }
+  tst_emit_block(ts, write_block, NULL);
+  old_t = 0;
+  tb = 0;
+}
+
+static void process(char* filename) {
+  if(ts != NULL) {
+    end_file();
+  }
+  if(meta_add && out_csv) {
+    wr_printf("# process %s\n", filename);
+  }
+  open_filename(filename);
+  read_input();
+  bytes_in += rd_bytes(in);
+  rd_close(in);
+}
+
+static void finish_output() {
+  if(ts != NULL) { // the last -agg bucket or -sd row
+    write_flush();
+    tst_end(ts);
+  }
+  if(bw != NULL) {
+    bin_w_close(bw);
+    bw = NULL;
+  }
+  if(aw != NULL) {
+    arrow_w_close(aw);
+    aw = NULL;
+  }
+  wr_flush();
+}
+
+
+
+// -jobs N: each file is processed by a child process of its own,
+// so it starts with fresh state, writing into an unlinked temporary
+// file.  At most N run at once and their output is copied to stdout
+// in command line order as soon as all the files before it are done.
+
+struct job {
+  pid_t pid;
+  int fd; // where the output went
+  int sfd; // and the -stats totals
+  int status; // exit status once done
+  bool done;
+};
+
+static int job_tmpfile() {
+  char* dir = getenv("TMPDIR");
+  char tmpl[4096];
+  snprintf(tmpl, sizeof(tmpl), "%s/tstXXXXXX", dir ? dir : "/tmp");
+  int fd = mkstemp(tmpl);
+  if(fd < 0) {
+    fprintf(stderr, "%s: fatal cannot create temporary file %s: %s\n",
+	    get_progname(), tmpl, strerror(errno));
+    exit(106);
+  }
+  unlink(tmpl);
+  return fd;
+}
+
+static void start_job(struct job* j, char* filename) {
+  j->fd = job_tmpfile();
+  j->sfd = stats ? job_tmpfile() : -1;
+  wr_flush(); // don't let the child inherit buffered output
+  if((j->pid = fork()) < 0) {
+    fprintf(stderr, "%s: fatal cannot fork: %s\n",
+	    get_progname(), strerror(errno));
+    exit(107);
+  } else if(j->pid == 0) { // child
+    wr_init(j->fd, "size");
+    if(stats) {
+      stats_fork();
+    }
+    process(filename);
+    finish_output();
+    if(stats) { // for the parent to report
+      stats_send(j->sfd);
+    }
+    exit(0);
+  }
+}
+
+// copy the output of j to ours
+static void emit_job(struct job* j) {
+  char buf[64 * 1024];
+  ssize_t n;
+  lseek(j->fd, 0, SEEK_SET);
+  while((n = read(j->fd, buf, sizeof(buf))) > 0) {
+    wr_mem(buf, n);
+  }
+  close(j->fd);
+  if(j->sfd >= 0) {
+    stats_recv(j->sfd);
+    close(j->sfd);
+  }
+}
+
+static void process_jobs() {
+  int n;
+  for(n = 0; get_filename(n) != NULL; n++) {
+  }
+  struct job* js = calloc(n, sizeof(struct job));
+  if(js == NULL) {
+    fprintf(stderr, "%s: fatal out of memory for jobs\n", get_progname());
+    exit(108);
+  }
+
+  int next = 0; // next job to start
+  int out = 0; // next job to emit
+  int running = 0;
+  int failed = 0; // exit status of the first failure
+  while(out < n) {
+    while(!failed && running < jobs && next < n) {
+      start_job(&js[next], get_filename(next));
+      next++;
+      running++;
+    }
+    if(running > 0) {
+      int status;
+      pid_t pid = wait(&status);
+      int i;
+      for(i = out; i < next; i++) {
+	if(js[i].pid == pid) {
+	  js[i].done = true;
+	  js[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : 128;
+	  running--;
+	}
+      }
+    }
+    while(!failed && out < next && js[out].done) {
+      emit_job(&js[out]);
+      if(js[out].status != 0 && !failed) { // stop like we do without -jobs
+	failed = js[out].status;
+      }
+      out++;
     }
-    if(ot == t) {
-      write_output1(t, v);
+    if(failed && running == 0) {
+      for(; out < next; out++) {
+	close(js[out].fd);
+	if(js[out].sfd >= 0) {
+	  close(js[out].sfd);
+	}
+      }
+      exit(failed);
     }
   }
+  free(js);
 }
 
+// -merge and -asof: the files are read side by side and a heap on
+// each file's next time picks which row goes next, so memory is
+// constant per file.  -merge interleaves the rows of files with the
+// same number of values (in file order for equal times), -asof
+// writes one wide row of every file's latest values (NaN until a
+// file's first row) for each distinct time.
 
-double zdb = 0;
-double dv = 0;
+struct input {
+  struct rd* r;
+  struct fields fs;
+  int nv; // value columns
+  char** labels; // labels[0..nv-1]
+  bool delta;
+  tms tsize;
+  tms old_t; // for delta times
+  tms t; // the current row
+  double* v; // v[0..nv-1]
+  int off; // where v goes in an -asof row
+};
 
-bool v_changed(double v) {
-  static double ov; 
-  static bool first = true; // first 
-  if(first) {
-    first = false;
-    ov = v;
-    return true;
+// input_line - next line of p that isn't meta data or empty
+static char* input_line(struct input* p, size_t* len) {
+  char* s;
+  while((s = rd_line(p->r, len)) != NULL &&
+	((meta_strip && s[0] == '#') || *len == 0)) {
   }
+  return s;
+}
 
-  if(-zdb < v && v < zdb) { // treat it 0 since its in zdb
-    v = 0;
+static void input_open(struct input* p, char* filename) {
+  errno = 0;
+  if((p->r = rd_open(filename)) == NULL) {
+    fprintf(stderr, "%s: fatal error cannot open file \"%s\": %s\n",
+	    get_progname(), filename, strerror(errno));
+    exit(103);
   }
-  double d = v - ov; // the change in value 
-  if(-dv < d && d < dv) { // less than dv so ignore it
-    return false;
-  } else {
-    ov = v;
-    return true;
+  if(bin_is(p->r)) {
+    fprintf(stderr, "%s: fatal -merge/-asof only read text, not \"%s\"\n",
+	    get_progname(), filename);
+    exit(117);
+  }
+  size_t len;
+  char* s = input_line(p, &len);
+  if(s == NULL) {
+    fprintf(stderr, "oops: no header\n");
+    exit(11);
+  }
+  int n = split_fields(&p->fs, s, len, isep);
+  if(n < 2) {
+    fprintf(stderr, "oops must have at least two fields in header\n");
+    exit(99);
+  }
+  if(!parse_t_header(p->fs.f[0], &p->delta, &p->tsize)) {
+    fprintf(stderr, "failed to parse tlabel %s\n", p->fs.f[0]);
+    exit(100);
+  }
+  p->nv = n - 1;
+  p->labels = calloc(p->nv, sizeof(char*));
+  p->v = calloc(p->nv, sizeof(double));
+  if(p->labels == NULL || p->v == NULL) {
+    fprintf(stderr, "oops: out of memory for %d columns\n", p->nv);
+    exit(12);
+  }
+  int i;
+  for(i = 0; i < p->nv; i++) {
+    p->labels[i] = strdup(p->fs.f[i + 1]);
   }
 }
 
-void write_sample(tms t, double v) {
-  tms tv;
-  static tms tb;
+// input_next - read p's next row, false at the end
+static bool input_next(struct input* p) {
+  char* s;
+  size_t len;
+  while((s = input_line(p, &len)) != NULL) {
+    if(parse_row(&p->fs, s, len, p->nv, p->tsize, p->labels,
+		 &p->t, p->v)) {
+      if(p->delta) {
+	p->t += p->old_t;
+	p->old_t = p->t;
+      }
+      return true;
+    }
+  }
+  return false;
+}
 
-  if(write_delta) { 
-    tv = (t - tb) / write_tsize;
-  } else {
-    tv =  t / write_tsize;
+// heap_down - restore the heap h[0..n-1] below i, earliest first
+//   and in file order for equal times
+static void heap_down(struct input** h, int n, int i) {
+  for(;;) {
+    int m = i, c;
+    for(c = 2 * i + 1; c <= 2 * i + 2 && c < n; c++) {
+      if(h[c]->t < h[m]->t || (h[c]->t == h[m]->t && h[c] < h[m])) {
+	m = c;
+      }
+    }
+    if(m == i) {
+      return;
+    }
+    struct input* x = h[i];
+    h[i] = h[m];
+    h[m] = x;
+    i = m;
+  }
+}
+
+static void process_merge() {
+  int n, i, k = 0, total = 0;
+  for(n = 0; get_filename(n) != NULL; n++) {
   }
-  tb = t;
-  if(strcmp(topt, "iso") == 0) { // ttt speed
-    printf("%s", fmt_t(t));
-  } else if(topt[0] == '%') {
-    printf("%s", fmt_tg(t, topt));
+  struct input* ps = calloc(n, sizeof(struct input));
+  struct input** h = calloc(n, sizeof(struct input*));
+  if(ps == NULL || h == NULL) {
+    fprintf(stderr, "oops: out of memory for %d files\n", n);
+    exit(12);
+  }
+  for(i = 0; i < n; i++) {
+    if(meta_add && out_csv) {
+      wr_printf("# process %s\n", get_filename(i));
+    }
+    input_open(&ps[i], get_filename(i));
+    if(!asof && ps[i].nv != ps[0].nv) {
+      fprintf(stderr, "oops header has %d values but expected %d\n",
+	      ps[i].nv, ps[0].nv);
+      exit(98);
+    }
+    ps[i].off = total;
+    total += ps[i].nv;
+  }
+
+  // the output looks like the first file, or all of them side by side
+  read_delta = ps[0].delta;
+  read_tsize = ps[0].tsize;
+  double* row = NULL;
+  if(asof) {
+    char** labels = calloc(total, sizeof(char*));
+    row = calloc(total, sizeof(double));
+    if(labels == NULL || row == NULL) {
+      fprintf(stderr, "oops: out of memory for %d columns\n", total);
+      exit(12);
+    }
+    for(i = 0; i < n; i++) {
+      memcpy(labels + ps[i].off, ps[i].labels, ps[i].nv * sizeof(char*));
+    }
+    for(i = 0; i < total; i++) {
+      row[i] = NAN;
+    }
+    set_values(total, labels);
+    free(labels);
   } else {
-    printf("%ld", tv);
+    set_values(ps[0].nv, ps[0].labels);
+  }
+  write_header();
+
+  for(i = 0; i < n; i++) {
+    if(input_next(&ps[i])) {
+      h[k++] = &ps[i];
+    }
+  }
+  for(i = k / 2 - 1; i >= 0; i--) {
+    heap_down(h, k, i);
   }
-  printf("%s", sep);
-  printf(vfmt, v);
-  printf("%s", recsep);
+  while(k > 0) {
+    struct input* p = h[0];
+    tms t = p->t;
+    if(asof) {
+      memcpy(row + p->off, p->v, p->nv * sizeof(double));
+    } else {
+      write_output(t, p->v);
+    }
+    if(!input_next(p)) { // this one's done
+      h[0] = h[--k];
+    }
+    heap_down(h, k, 0);
+    if(asof && (k == 0 || h[0]->t != t)) { // that's all for t
+      write_output(t, row);
+    }
+  }
+  write_flush();
+
+  for(i = 0; i < n; i++) {
+    bytes_in += rd_bytes(ps[i].r);
+    rd_close(ps[i].r);
+    free_fields(&ps[i].fs);
+    int j;
+    for(j = 0; j < ps[i].nv; j++) {
+      free(ps[i].labels[j]);
+    }
+    free(ps[i].labels);
+    free(ps[i].v);
+  }
+  free(row);
+  free(h);
+  free(ps);
+}
+
+// -follow: the file is read to its end and then, rather than
+// stopping, inotify tells us when it has grown so only the rows
+// appended since are read.  Whenever we catch up the output is
+// flushed and the offset of the first unread line plus the state
+// it has built up (delta times, -every, -dv, -agg and -sd) goes to
+// the -checkpoint file, so a restart carries on exactly where the
+// last run got to.  SIGINT and SIGTERM stop it at the next line.
+
+static int ifd = -1; // inotify
+static size_t saved = (size_t) -1; // offset in the checkpoint
+static ino_t inode; // the file we're following
+
+static void follow_stop(int sig) {
+  stopping = 1;
 }
 
-void write_output1(tms t, double v) {
-  if(st <= t && t <= et) {
-    if(v_changed(v)) { 
-      write_sample(t, v);
+static void process_follow() {
+  if(get_filename(1) != NULL || !out_csv || strcmp(inopt, "bin") == 0) {
+    fprintf(stderr, "%s: fatal -follow reads a single csv file "
+	    "and writes csv\n", get_progname());
+    exit(119);
+  }
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = follow_stop; // no SA_RESTART so poll wakes up
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  inname = get_filename(0);
+  parse_t_reset();
+  errno = 0;
+  if((in = rd_follow(inname, 0)) == NULL) {
+    fprintf(stderr, "%s: fatal error cannot open file \"%s\": %s\n",
+	    get_progname(), inname, strerror(errno));
+    exit(103);
+  }
+  struct stat sb;
+  if(stat(inname, &sb) == 0) {
+    inode = sb.st_ino;
+  }
+  if((ifd = inotify_init1(IN_CLOEXEC)) >= 0 &&
+     inotify_add_watch(ifd, inname, IN_MODIFY | IN_ATTRIB |
+		       IN_MOVE_SELF | IN_DELETE_SELF) < 0) {
+    close(ifd);
+    ifd = -1; // so just look every second
+  }
+  read_input(); // only returns through follow_wait
+}
+
+// checkpoint_save - write the state to checkpoint.tmp and rename
+//   it over checkpoint so there is always a whole one
+static void checkpoint_save(size_t off) {
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", checkpoint);
+  FILE* fp = fopen(tmp, "w");
+  if(fp == NULL) {
+    fprintf(stderr, "%s: fatal cannot write checkpoint %s: %s\n",
+	    get_progname(), tmp, strerror(errno));
+    exit(120);
+  }
+  fprintf(fp, "tst-checkpoint 2\n");
+  fprintf(fp, "offset %zu\n", off);
+  fprintf(fp, "t %ld %ld\n", old_t, tb);
+  tst_save(ts, fp);
+  if(fflush(fp) != 0 || fsync(fileno(fp)) != 0 || fclose(fp) != 0 ||
+     rename(tmp, checkpoint) != 0) {
+    fprintf(stderr, "%s: fatal cannot write checkpoint %s: %s\n",
+	    get_progname(), checkpoint, strerror(errno));
+    exit(120);
+  }
+}
+
+// follow_resume - load the checkpoint (if any) once the header has
+//   been read and seek to where it left off
+static bool follow_resume() {
+  FILE* fp = checkpoint[0] ? fopen(checkpoint, "r") : NULL;
+  if(fp == NULL) {
+    return false;
+  }
+  size_t off;
+  bool ok = fscanf(fp, "tst-checkpoint 2 offset %zu t %ld %ld",
+		   &off, &old_t, &tb) == 3 && tst_load(ts, fp);
+  fclose(fp);
+  if(!ok) {
+    fprintf(stderr, "%s: fatal checkpoint %s doesn't match %s "
+	    "or these options\n", get_progname(), checkpoint, inname);
+    exit(120);
+  }
+  rd_seek(in, off);
+  saved = off;
+  return true;
+}
+
+// follow_wait - we've caught up so save where we are and wait for
+//   more, exiting instead if we've been asked to stop or the file
+//   has been truncated or replaced under us.
+static void follow_wait() {
+  size_t off = rd_tell(in);
+  if(nv > 0 && off != saved) { // past the header and something new
+    write_flush();
+    wr_flush();
+    if(checkpoint[0]) {
+      checkpoint_save(off);
+    }
+    saved = off;
+  }
+  if(stopping) {
+    exit(0);
+  }
+  struct stat sb;
+  if(stat(inname, &sb) != 0 || sb.st_ino != inode ||
+     (size_t) sb.st_size < off) {
+    fprintf(stderr, "%s: fatal %s was truncated or replaced at %zu\n",
+	    get_progname(), inname, off);
+    exit(121);
+  }
+  // anything appended since the watch started is already queued
+  // so there's no race, the events are only used to wake us
+  struct pollfd p = { ifd, POLLIN, 0 };
+  if(poll(&p, ifd >= 0 ? 1 : 0, 1000) > 0) {
+    char buf[4096];
+    if(read(ifd, buf, sizeof(buf)) < 0) {
+      // woken by a signal, we'll see stopping next time
     }
-  } else { 
-    // outside the -st..-et range
   }
 }
 
-static void process(char* filename) {
-  if(meta_add) {
-    printf("# process %s\n", filename);
+// -stats: each row's trip through the stages is timed with the
+// cycle counter, which stats_report converts to ms by timing the
+// whole run against the clock.  Writing happens within the
+// pipeline (whenever the buffer fills) so it's taken out of it.
+
+static unsigned long stats_c0; // cycles at the start
+static struct timespec stats_t0; // and the time
+
+static void stats_start() {
+  wr_stats(true);
+  clock_gettime(CLOCK_MONOTONIC, &stats_t0);
+  stats_c0 = stats_clock();
+}
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// stats_add - s (this thread's) into sts_all and start again
+static void stats_add(struct stats* s) {
+  pthread_mutex_lock(&stats_lock);
+  int i;
+  for(i = 0; i < ST_N; i++) {
+    sts_all.cyc[i] += s->cyc[i];
   }
-  open_filename(filename);
-  setlinebuf(stdout);
-  read_input();
+  sts_all.bad += s->bad;
+  sts_all.pt.iso += parse_t_counts.iso;
+  sts_all.pt.hit += parse_t_counts.hit;
+  sts_all.pt.miss += parse_t_counts.miss;
+  sts_all.pt.fallback += parse_t_counts.fallback;
+  sts_all.pt.bad += parse_t_counts.bad;
+  pthread_mutex_unlock(&stats_lock);
+  memset(s, 0, sizeof(*s));
+  memset(&parse_t_counts, 0, sizeof(parse_t_counts));
 }
 
+// stats_total - the totals of this process and any -jobs children
+static void stats_total(struct stats_total* t) {
+  stats_add(&sts);
+  unsigned long wc;
+  wr_bytes(&wc);
+  t->s = sts_all;
+  t->s.cyc[ST_WRITE] += wc;
+  if(ts != NULL) { // our writing was done in the pipeline
+    t->s.cyc[ST_PIPE] -= wc < t->s.cyc[ST_PIPE] ? wc : t->s.cyc[ST_PIPE];
+  }
+  t->n = counts;
+  if(ts != NULL) {
+    counts_add(&t->n, tst_counts(ts));
+  }
+  t->bytes_in = bytes_in;
+}
 
+static void stats_send(int fd) {
+  struct stats_total t;
+  stats_total(&t);
+  if(write(fd, &t, sizeof(t)) != sizeof(t)) {
+    fprintf(stderr, "%s: -stats for a job lost: %s\n",
+	    get_progname(), strerror(errno));
+  }
+}
+
+static void stats_recv(int fd) {
+  struct stats_total t;
+  if(pread(fd, &t, sizeof(t), 0) != sizeof(t)) {
+    return; // the child failed
+  }
+  int i;
+  for(i = 0; i < ST_N; i++) {
+    sts_all.cyc[i] += t.s.cyc[i];
+  }
+  sts_all.bad += t.s.bad;
+  sts_all.pt.iso += t.s.pt.iso;
+  sts_all.pt.hit += t.s.pt.hit;
+  sts_all.pt.miss += t.s.pt.miss;
+  sts_all.pt.fallback += t.s.pt.fallback;
+  sts_all.pt.bad += t.s.pt.bad;
+  counts_add(&counts, &t.n);
+  bytes_in += t.bytes_in;
+}
+
+// stats_fork - forget what we inherited from the parent
+static void stats_fork() {
+  memset(&sts, 0, sizeof(sts));
+  memset(&sts_all, 0, sizeof(sts_all));
+  memset(&parse_t_counts, 0, sizeof(parse_t_counts));
+  memset(&counts, 0, sizeof(counts));
+  bytes_in = 0;
+  wr_stats(true);
+}
+
+static void stats_report() {
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  unsigned long c1 = stats_clock();
+  double ms = (t1.tv_sec - stats_t0.tv_sec) * 1e3 +
+    (t1.tv_nsec - stats_t0.tv_nsec) * 1e-6;
+  double ms_per = c1 > stats_c0 ? ms / (c1 - stats_c0) : 0;
+
+  struct stats_total total;
+  stats_total(&total);
+  struct stats* s = &total.s;
+  struct tst_counts* n = &total.n;
+  unsigned long wc;
+  long bytes_out = wr_bytes(&wc);
+  char* names[ST_N] = { "read", "split", "time", "value",
+			"pipeline", "write" };
+  int i;
+  if(strcmp(stats_opt, "json") == 0) {
+    fprintf(stderr, "{\"ms\":%.3f,\"rows_in\":%ld,\"rows_bad\":%ld,"
+	    "\"rows_out\":%ld,\"bytes_in\":%zu,\"bytes_out\":%ld,"
+	    "\"stages\":{", ms, n->samples, s->bad, n->out,
+	    (size_t) total.bytes_in, bytes_out);
+    for(i = 0; i < ST_N; i++) {
+      fprintf(stderr, "%s\"%s\":{\"cycles\":%lu,\"ms\":%.3f}",
+	      i ? "," : "", names[i], s->cyc[i], s->cyc[i] * ms_per);
+    }
+    fprintf(stderr, "},\"parse_t\":{\"iso\":%ld,\"hit\":%ld,\"miss\":%ld,"
+	    "\"fallback\":%ld,\"bad\":%ld},", s->pt.iso, s->pt.hit,
+	    s->pt.miss, s->pt.fallback, s->pt.bad);
+    fprintf(stderr, "\"rows\":{\"resampled\":%ld,\"outside_st_et\":%ld,"
+	    "\"outside_vmin_vmax\":%ld,\"unchanged\":%ld,\"sd\":%ld}}\n",
+	    n->rows, n->trange, n->vrange, n->unchanged,
+	    n->rows - n->trange - n->vrange - n->unchanged - n->out);
+    return;
+  }
+  char* p = get_progname();
+  fprintf(stderr, "%s: stats %.3f ms\n", p, ms);
+  fprintf(stderr, "%s: stats rows in %ld bad %ld out %ld\n",
+	  p, n->samples, s->bad, n->out);
+  fprintf(stderr, "%s: stats bytes in %zu out %ld\n",
+	  p, (size_t) total.bytes_in, bytes_out);
+  for(i = 0; i < ST_N; i++) {
+    fprintf(stderr, "%s: stats %-8s %14lu cycles %10.3f ms\n",
+	    p, names[i], s->cyc[i], s->cyc[i] * ms_per);
+  }
+  fprintf(stderr, "%s: stats parse_t iso %ld hit %ld miss %ld "
+	  "fallback %ld bad %ld\n", p, s->pt.iso, s->pt.hit, s->pt.miss,
+	  s->pt.fallback, s->pt.bad);
+  fprintf(stderr, "%s: stats resampled %ld outside -st/-et %ld "
+	  "-vmin/-vmax %ld unchanged %ld sd %ld\n", p, n->rows, n->trange,
+	  n->vrange, n->unchanged,
+	  n->rows - n->trange - n->vrange - n->unchanged - n->out);
+}